@@ -38,7 +38,10 @@ ExprPtr Expr::make_number(double n)
 
 ExprPtr Expr::make_boolean(bool n)
 {
-    return make_unique<Expr>(n);
+    auto e = make_unique<Expr>();
+    e->kind = KBoolean;
+    e->num = n ? 1.0 : 0.0;
+    return e;
 }
 
 ExprPtr Expr::make_string(const std::string &s)
@@ -60,6 +63,42 @@ ExprPtr Expr::make_funcliteral(vector<string> &&params, vector<StmtPtr> &&body)
     return e;
 }
 
+ExprPtr Expr::make_unary(const std::string &op, ExprPtr operand)
+{
+    auto e = make_unique<Expr>();
+    e->kind = KUnary;
+    e->op = op;
+    e->args.push_back(move(operand));
+    return e;
+}
+
+ExprPtr Expr::make_binary(const std::string &op, ExprPtr lhs, ExprPtr rhs)
+{
+    auto e = make_unique<Expr>();
+    e->kind = KBinary;
+    e->op = op;
+    e->args.push_back(move(lhs));
+    e->args.push_back(move(rhs));
+    return e;
+}
+
+ExprPtr Expr::make_logical(const std::string &op, ExprPtr lhs, ExprPtr rhs)
+{
+    auto e = make_binary(op, move(lhs), move(rhs));
+    e->kind = KLogical;
+    return e;
+}
+
+ExprPtr Expr::make_conditional(ExprPtr cond, ExprPtr then_expr, ExprPtr else_expr)
+{
+    auto e = make_unique<Expr>();
+    e->kind = KConditional;
+    e->args.push_back(move(cond));
+    e->args.push_back(move(then_expr));
+    e->args.push_back(move(else_expr));
+    return e;
+}
+
 // ---------------- Stmt implementations ----------------
 
 Stmt::Stmt(): kind(KExpr) { }
@@ -124,6 +163,19 @@ StmtPtr Stmt::make_foreach(const std::string &itname, ExprPtr iter_expr, vector<
     return s;
 }
 
+// for
+StmtPtr Stmt::make_for(const std::string &itname, ExprPtr start, ExprPtr limit, ExprPtr step, vector<StmtPtr> &&body)
+{
+    auto s = make_unique<Stmt>();
+    s->kind = KFor;
+    s->iter_name = itname;
+    s->range_start = move(start);
+    s->range_limit = move(limit);
+    s->range_step = move(step);
+    s->foreach_body = move(body);
+    return s;
+}
+
 // return
 StmtPtr Stmt::make_return(ExprPtr e)
 {
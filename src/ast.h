@@ -21,7 +21,11 @@ struct Expr {
         KIdent,
         KCall,
         KCallExpr,
-        KFuncLiteral
+        KFuncLiteral,
+        KUnary,
+        KBinary,
+        KLogical,
+        KConditional
     } kind;
 
     // number
@@ -37,6 +41,11 @@ struct Expr {
     std::string call_name;
     std::vector<ExprPtr> args;
 
+    // unary / binary operator: spelling in op, operands in args.
+    // logical: op is "and" or "or", the operands in args.
+    // conditional (c ? a : b): args holds c, a, b
+    std::string op;
+
     // function literal
     std::vector<std::string> params;
     std::vector<StmtPtr> body;
@@ -52,6 +61,10 @@ struct Expr {
     static ExprPtr make_string(const std::string &s);
     static ExprPtr make_call(const std::string &name, std::vector<ExprPtr> &&args);
     static ExprPtr make_funcliteral(std::vector<std::string> &&params, std::vector<StmtPtr> &&body);
+    static ExprPtr make_unary(const std::string &op, ExprPtr operand);
+    static ExprPtr make_binary(const std::string &op, ExprPtr lhs, ExprPtr rhs);
+    static ExprPtr make_logical(const std::string &op, ExprPtr lhs, ExprPtr rhs);
+    static ExprPtr make_conditional(ExprPtr cond, ExprPtr then_expr, ExprPtr else_expr);
 };
 
 struct Stmt {
@@ -62,6 +75,7 @@ struct Stmt {
         KIf,
         KWhile,
         KForeach,
+        KFor,
         KReturn
     } kind;
 
@@ -91,6 +105,12 @@ struct Stmt {
     ExprPtr iter_expr;
     std::vector<StmtPtr> foreach_body;
 
+    // for numeric for
+    // iter_name + foreach_body used; range_step may be null (step 1)
+    ExprPtr range_start;
+    ExprPtr range_limit;
+    ExprPtr range_step;
+
     // for return
     // expr used
 
@@ -102,6 +122,8 @@ struct Stmt {
     static StmtPtr make_if(ExprPtr cond, std::vector<StmtPtr> &&then_body);
     static StmtPtr make_while(ExprPtr cond, std::vector<StmtPtr> &&body);
     static StmtPtr make_foreach(const std::string &itname, ExprPtr iter_expr, std::vector<StmtPtr> &&body);
+    static StmtPtr make_for(const std::string &itname, ExprPtr start, ExprPtr limit, ExprPtr step,
+                            std::vector<StmtPtr> &&body);
     static StmtPtr make_return(ExprPtr e);
 };
 
@@ -39,6 +39,7 @@ namespace facts
             // logical and / or
             case TokenKind::LogicalAnd:       return 40; // &
             case TokenKind::LogicalOr:         return 30; // |
+            case TokenKind::Question:     return 20; // c ? a : b
             case TokenKind::Equal:        return 10;
 
             default:
@@ -51,6 +52,7 @@ namespace facts
         switch(k)
         {
             case TokenKind::Equal:        return true; // a = b = c -> right associative
+            case TokenKind::Question:     return true; // a ? b : c ? d : e -> a ? b : (c ? d : e)
             default:
                 return false;
         }
@@ -86,4 +88,50 @@ namespace facts
     {
         return get_precedence(k) > 0 && !is_postfix(k);
     }
-}
+
+    int get_prefix_precedence(TokenKind k)
+    {
+        // every prefix operator binds tighter than the binary ones ('-a + b' is '(-a) + b')
+        return is_prefix(k) ? get_precedence(TokenKind::Exclamation) : 0;
+    }
+
+    // operators lowered to dedicated VM opcodes instead of host calls
+    bool is_native_unary(TokenKind k)
+    {
+        switch(k)
+        {
+            case TokenKind::Exclamation:
+            case TokenKind::Minus:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // and / or: compiled to jumps that skip the right operand
+    bool is_logical(TokenKind k)
+    {
+        return k == TokenKind::LogicalAnd || k == TokenKind::LogicalOr;
+    }
+
+    bool is_native_binary(TokenKind k)
+    {
+        switch(k)
+        {
+            case TokenKind::Plus:
+            case TokenKind::Minus:
+            case TokenKind::Star:
+            case TokenKind::Slash:
+            case TokenKind::Percent:
+            case TokenKind::Less:
+            case TokenKind::LessEqual:
+            case TokenKind::Greater:
+            case TokenKind::GreaterEqual:
+            case TokenKind::EqualEqual:
+            case TokenKind::NotEqual:
+                return true;
+            default:
+                return false;
+        }
+    }
+}
\ No newline at end of file
@@ -10,6 +10,10 @@ namespace facts
     bool is_postfix(TokenKind k);
     bool is_prefix(TokenKind k);
     bool is_infix(TokenKind k);
+    int get_prefix_precedence(TokenKind k);
+    bool is_native_unary(TokenKind k);
+    bool is_native_binary(TokenKind k);
+    bool is_logical(TokenKind k);
 }
 
 #endif
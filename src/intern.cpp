@@ -0,0 +1,59 @@
+#include "intern.h"
+
+using namespace std;
+
+// takes a reference unless the object is already being destroyed
+static bool try_retain(StringObject *o)
+{
+    uint32_t r = o->refs.load(memory_order_relaxed);
+    while(r != 0)
+    {
+        if(o->refs.compare_exchange_weak(r, r + 1, memory_order_acq_rel))
+            return true;
+    }
+    return false;
+}
+
+Value InternTable::intern(string_view s, size_t hash)
+{
+    Shard &sh = shard_for(hash);
+    lock_guard<mutex> lk(sh.mtx);
+
+    auto it = sh.map.find(Key{s, hash});
+    if(it != sh.map.end() && try_retain(it->second))
+        return Value::adopt_string(it->second);
+
+    // either absent or dying: a dying entry is overwritten here and left
+    // alone by its forget() since it no longer maps to that object
+    StringObject *o = new StringObject(string(s), hash, true);
+    if(it != sh.map.end()) sh.map.erase(it);
+    sh.map.emplace(Key{o->str, hash}, o);
+    return Value::adopt_string(o);
+}
+
+void InternTable::forget(StringObject *o)
+{
+    Shard &sh = shard_for(o->hash);
+    lock_guard<mutex> lk(sh.mtx);
+
+    auto it = sh.map.find(Key{o->str, o->hash});
+    if(it != sh.map.end() && it->second == o)
+        sh.map.erase(it);
+}
+
+size_t InternTable::size()
+{
+    size_t n = 0;
+    for(auto &sh : shards)
+    {
+        lock_guard<mutex> lk(sh.mtx);
+        n += sh.map.size();
+    }
+    return n;
+}
+
+InternTable &intern_table()
+{
+    static InternTable *table = new InternTable();
+    return *table;
+}
@@ -0,0 +1,51 @@
+#ifndef MONDOT_INTERN_H
+#define MONDOT_INTERN_H
+
+#include "value.h"
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Runtime-wide string intern table. Entries are weak: the table does not own
+// a reference, and an interned StringObject removes itself when its last
+// Value goes away, so the table only ever holds live strings.
+struct InternTable
+{
+    static constexpr size_t SHARDS = 16;
+
+    Value intern(std::string_view s, size_t hash);
+    void forget(StringObject *o);
+    size_t size();
+
+private:
+    struct Key
+    {
+        std::string_view str;
+        size_t hash;
+        bool operator==(const Key &o) const { return hash == o.hash && str == o.str; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &k) const { return k.hash; }
+    };
+    struct Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<Key, StringObject*, KeyHash> map;
+    };
+    Shard shards[SHARDS];
+
+    Shard &shard_for(size_t hash) { return shards[(hash >> 7) % SHARDS]; }
+};
+
+// never destroyed, so Values with static storage duration can still
+// release their strings during shutdown
+InternTable &intern_table();
+
+inline size_t hash_string(std::string_view s)
+{
+    return std::hash<std::string_view>{}(s);
+}
+
+#endif
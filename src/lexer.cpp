@@ -82,8 +82,12 @@ Token Lexer::next()
         else if(s == "else") t.kind = TokenKind::Kw_else;
         else if(s == "while") t.kind = TokenKind::Kw_while;
         else if(s == "foreach") t.kind = TokenKind::Kw_foreach;
+        else if(s == "for") t.kind = TokenKind::Kw_for;
         else if(s == "in") t.kind = TokenKind::Kw_in;
         else if(s == "return") t.kind = TokenKind::Kw_return;
+        else if(s == "and") t.kind = TokenKind::LogicalAnd;
+        else if(s == "or") t.kind = TokenKind::LogicalOr;
+        else if(s == "not") t.kind = TokenKind::Exclamation;
         else if(s == "true") t.kind = TokenKind::Boolean;
         else if(s == "false") t.kind = TokenKind::Boolean;
         else if(s == "nil") t.kind = TokenKind::Nil;
@@ -139,6 +143,7 @@ Token Lexer::next()
     }
 
     char ch = get();
+    t.text = string(1, ch);
     switch(ch)
     {
         case '(': t.kind = TokenKind::LParen; break;
@@ -150,6 +155,8 @@ Token Lexer::next()
         case ';': t.kind = TokenKind::Semicolon; break;
         case ',': t.kind = TokenKind::Comma; break;
         case '~': t.kind = TokenKind::Tilde; break;
+        case '?': t.kind = TokenKind::Question; break;
+        case ':': t.kind = TokenKind::Colon; break;
 
         case '=':
             if(peek() == '=')
@@ -20,6 +20,7 @@ enum class TokenKind
     Kw_else,
     Kw_while,
     Kw_foreach,
+    Kw_for,
     Kw_in,
     Kw_return,
     
@@ -32,6 +33,8 @@ enum class TokenKind
     RBrace,
     Semicolon,
     Comma,
+    Question,
+    Colon,
 
     Plus,
     Minus,
@@ -14,7 +14,10 @@ int main(int argc, char **argv)
 
     if(argc < 2)
     {
-        cout << "Usage: mondot <scripts-dir> [--test|--benchmark|--production]";
+        cout << "Usage: mondot <scripts-dir> [--test|--benchmark|--production|--opcode-pairs|--jit-diff|--types] [-O0|-O1|-O2] [--max-call-depth N] [--no-jit] [--eager] [--aot <out.so>] [--aot-lib <lib.so>]\n"
+                "  --eager  compile every handler at startup. Otherwise a handler compiles on its\n"
+                "           first call and its compile errors show only then: a broken handler\n"
+                "           that is never called (e.g. UTest under --production) is never reported.\n";
         return 1;
     }
 
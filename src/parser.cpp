@@ -226,6 +226,33 @@ unique_ptr<Stmt> Parser::parse_statement()
         expect(TokenKind::Kw_end, "end");
         return Stmt::make_foreach(itname, move(iter_expr), move(body));
     }
+    if(cur.kind == TokenKind::Kw_for)
+    {
+        // for (name = start, limit [, step]) stmts end
+        eat();
+        expect(TokenKind::LParen, "(");
+        if(cur.kind != TokenKind::Identifier) throw runtime_error("expected identifier after for");
+
+        string itname = cur.text; eat();
+        expect(TokenKind::Equal, "=");
+        auto start = parse_expression();
+        expect(TokenKind::Comma, ",");
+        auto limit = parse_expression();
+        ExprPtr step;
+        if(cur.kind == TokenKind::Comma)
+        {
+            eat();
+            step = parse_expression();
+        }
+        expect(TokenKind::RParen, ")");
+
+        vector<unique_ptr<Stmt>> body;
+        while(cur.kind != TokenKind::Kw_end)
+            body.push_back(parse_statement());
+
+        expect(TokenKind::Kw_end, "end");
+        return Stmt::make_for(itname, move(start), move(limit), move(step), move(body));
+    }
     if(cur.kind == TokenKind::Kw_return)
     {
         eat();
@@ -282,10 +309,12 @@ unique_ptr<Expr> Parser::parse_primary()
     if(facts::is_prefix(cur.kind))
     {
         TokenKind op = cur.kind;
-        string opname = cur.text;
+        // 'not' is another spelling of '!'
+        string opname = op == TokenKind::Exclamation ? "!" : cur.text;
         eat();
 
-        auto rhs = parse_expression_prec(*this, facts::get_precedence(op));
+        auto rhs = parse_expression_prec(*this, facts::get_prefix_precedence(op));
+        if(facts::is_native_unary(op)) return Expr::make_unary(opname, move(rhs));
 
         vector<unique_ptr<Expr>> args;
         args.push_back(move(rhs));
@@ -295,12 +324,14 @@ unique_ptr<Expr> Parser::parse_primary()
     if(cur.kind == TokenKind::Boolean)
     {
         bool b = cur.text == "true"; eat();
-        return make_unique<Expr>(b);
+        return Expr::make_boolean(b);
     }
     if(cur.kind == TokenKind::Nil)
     {
         eat();
-        return make_unique<Expr>();
+        auto e = make_unique<Expr>();
+        e->kind = Expr::KNil;
+        return e;
     }
     if(cur.kind == TokenKind::Number)
     {
@@ -357,7 +388,8 @@ unique_ptr<Expr> Parser::parse_primary()
             temp = saved_lex.next(); // token after RParen
             if(temp.kind == TokenKind::Kw_end || temp.kind == TokenKind::Kw_local ||
                temp.kind == TokenKind::Kw_if || temp.kind == TokenKind::Kw_while ||
-               temp.kind == TokenKind::Kw_foreach || temp.kind == TokenKind::Kw_return) {
+               temp.kind == TokenKind::Kw_foreach || temp.kind == TokenKind::Kw_for ||
+               temp.kind == TokenKind::Kw_return) {
                 // function literal
                 return parse_func_literal();
             }
@@ -516,7 +548,27 @@ static unique_ptr<Expr> parse_expression_prec(Parser &p, int min_prec)
             string opname = p.cur.text;
             p.eat();
 
+            if(tok == TokenKind::Question)
+            {
+                // the middle operand is delimited by ':', like a parenthesized one
+                auto then_expr = p.parse_expression();
+                p.expect(TokenKind::Colon, ":");
+                auto else_expr = parse_expression_prec(p, next_min_prec);
+                left = Expr::make_conditional(move(left), move(then_expr), move(else_expr));
+                continue;
+            }
+
             auto right = parse_expression_prec(p, next_min_prec);
+            if(facts::is_logical(tok))
+            {
+                left = Expr::make_logical(tok == TokenKind::LogicalAnd ? "and" : "or", move(left), move(right));
+                continue;
+            }
+            if(facts::is_native_binary(tok))
+            {
+                left = Expr::make_binary(opname, move(left), move(right));
+                continue;
+            }
             vector<unique_ptr<Expr>> args;
             args.push_back(move(left));
             args.push_back(move(right));
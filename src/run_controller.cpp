@@ -4,6 +4,7 @@
 #include <chrono>
 #include <iomanip>
 #include <type_traits>
+#include <algorithm>
 
 #include "util.h"
 #include "fileutil.h"
@@ -13,6 +14,8 @@
 #include "runtime/module.h"
 #include "runtime/vm.h"
 #include "runtime/host_core_funcs.h"
+#include "runtime/host_test_funcs.h"
+#include "runtime/aot.h"
 
 using namespace std;
 namespace fs = std::filesystem;
@@ -37,6 +40,29 @@ void RunController::parse_args(int argc, char **argv)
         if (a == "--test") mode = Mode::Test;
         else if (a == "--benchmark") mode = Mode::Benchmark;
         else if (a == "--production") mode = Mode::Production;
+        else if (a == "--opcode-pairs") mode = Mode::OpcodePairs;
+        else if (a == "--jit-diff") mode = Mode::JitDiff;
+        else if (a == "--types") mode = Mode::Types;
+        else if (a == "--no-jit") vm.set_jit_mode(JitMode::Off);
+        else if (a == "--eager") eager = true;
+        else if (a == "--aot" && i + 1 < argc)
+        {
+            mode = Mode::Aot;
+            aot_out = argv[++i];
+        }
+        else if (a == "--aot-lib" && i + 1 < argc) aot_lib = argv[++i];
+        else if (a == "-O0" || a == "-O1" || a == "-O2") compile_opts.opt_level = a[2] - '0';
+        else if (a == "--max-call-depth" && i + 1 < argc)
+        {
+            try
+            {
+                vm.set_max_call_depth((size_t)stoul(argv[++i]));
+            }
+            catch (const std::exception &)
+            {
+                errlog(string("invalid --max-call-depth value: ") + argv[i]);
+            }
+        }
         else
             dbg("Unknown argument: " + a);
     }
@@ -50,6 +76,7 @@ bool RunController::is_script_ext(const fs::path &p)
 
 void RunController::initial_scan_and_load()
 {
+    auto t0 = chrono::steady_clock::now();
     scripts_map.reserve(256);
 
     for (auto &ent : fs::recursive_directory_iterator(scripts_dir))
@@ -67,66 +94,85 @@ void RunController::initial_scan_and_load()
         }
     }
 
+    // Startup only parses: each handler compiles on its first call, and the
+    // ones a mode never runs (UTest, UBenchmark, MdReload, ...) never do.
+    // Scripts the watcher loads later compile in full, so an edit reports
+    // its errors right away. --opcode-pairs counts the code of every handler.
+    compile_opts.lazy = !eager && mode != Mode::OpcodePairs;
     for (auto &kv : scripts_map)
         compile_and_register(fs::path(kv.first), true);
+    compile_opts.lazy = false;
+    load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
 }
 
 static std::string value_debug(const Value &v)
 {
-    switch (v.tag)
+    switch (v.tag())
     {
         case Tag::Nil: return "nil";
-        case Tag::Boolean: return v.boolean ? "true" : "false";
-        case Tag::Number: return std::to_string(v.num);
-        case Tag::String: return "\"" + *v.s + "\"";
+        case Tag::Boolean: return v.boolean() ? "true" : "false";
+        case Tag::Number: return std::to_string(v.num());
+        case Tag::String: return "\"" + v.str() + "\"";
         case Tag::Rule: return "<rule>";
     }
     return "<unknown>";
 }
 
-void RunController::compile_and_register(const fs::path &path, bool is_new)
+vector<CompiledUnit> RunController::compile_script(const fs::path &path)
 {
-    try
-    {
-        string src = slurp_file(path.string());
-        Parser parser(std::move(src));
-        auto prog = parser.parse_program();
+    string src = slurp_file(path.string());
+    Parser parser(std::move(src));
+    shared_ptr<Program> prog = parser.parse_program();
 #ifdef MONDOT_DEBUG
-        dump_program_tokens(prog.get());
+    dump_program_tokens(prog.get());
 #endif
-        if (prog->units.empty()) return;
+    // lazy handlers share ownership of the AST through their unit
+    vector<CompiledUnit> units;
+    for (auto &u : prog->units)
+        units.push_back(compile_unit(shared_ptr<UnitDecl>(prog, u.get()), compile_opts));
+    return units;
+}
+
+// makes m the live version of its unit and runs its lifecycle handlers
+void RunController::install_module(Module *m, bool is_new)
+{
+    G_MODULES.hot_swap(m);
 
-        for (auto &u : prog->units)
+    {
+        lock_guard<mutex> lk(G_MODULES.modules_mtx);
+        if (!m->mdinit_called && m->bytecode.handler_index.count("MdInit"))
         {
-            CompiledUnit cu = compile_unit(u.get());
-            Module *m = module_from_compiled(cu);
+            vm.execute_handler(m, "MdInit");
+            m->mdinit_called = true;
+        }
+    }
+    if (m->bytecode.handler_index.count("MdSuperInit"))
+    {
+        if (!super_called.test_and_set())
+        {
+            info("Calling MdSuperInit from module " + m->name);
+            vm.execute_handler(m, "MdSuperInit");
+        }
+    }
+
+    if (!is_new && m->bytecode.handler_index.count("MdReload"))
+    {
+        info("Calling MdReload for module " + m->name);
+        vm.execute_handler(m, "MdReload");
+    }
+}
+
+void RunController::compile_and_register(const fs::path &path, bool is_new)
+{
+    try
+    {
+        for (CompiledUnit &cu : compile_script(path))
+        {
+            Module *m = module_from_compiled(std::move(cu));
 #ifdef MONDOT_DEBUG
             dump_module_bytecode(m);
 #endif
-            G_MODULES.hot_swap(m);
-
-            {
-                lock_guard<mutex> lk(G_MODULES.modules_mtx);
-                if (!m->mdinit_called && m->bytecode.handler_index.count("MdInit"))
-                {
-                    vm.execute_handler(m, "MdInit");
-                    m->mdinit_called = true;
-                }
-            }
-            if (m->bytecode.handler_index.count("MdSuperInit"))
-            {
-                if (!super_called.test_and_set())
-                {
-                    info("Calling MdSuperInit from module " + m->name);
-                    vm.execute_handler(m, "MdSuperInit");
-                }
-            }
-
-            if (!is_new && m->bytecode.handler_index.count("MdReload"))
-            {
-                info("Calling MdReload for module " + m->name);
-                vm.execute_handler(m, "MdReload");
-            }
+            install_module(m, is_new);
         }
     }
     catch (const std::exception &e)
@@ -139,6 +185,16 @@ void RunController::compile_and_register(const fs::path &path, bool is_new)
     }
 }
 
+// installs every unit of --aot-lib in place of the scripts
+bool RunController::load_aot_library()
+{
+    vector<Module*> mods = aot_load_library(aot_lib);
+    if (mods.empty()) return false;
+    for (Module *m : mods) install_module(m, true);
+    info("Loaded " + to_string(mods.size()) + " AOT units from " + aot_lib);
+    return true;
+}
+
 void RunController::start_watcher()
 {
     stop_flag.store(false);
@@ -207,17 +263,22 @@ void RunController::watcher_loop()
     }
 }
 
-bool RunController::call_handler_bool(Module *m, const string &handler_name)
+static bool handler_result_bool(const Value &ret)
+{
+    if (ret.tag() == Tag::Boolean) return ret.boolean();
+    if (ret.tag() == Tag::Number) return ret.num() != 0.0;
+    return false;
+}
+
+bool RunController::call_handler_bool(Module *m, const string &handler_name, Value *raw)
 {
     if (!m->bytecode.handler_index.count(handler_name)) return false;
     try
     {
         Value ret = vm.execute_handler(m, handler_name);
-
-        if (ret.tag == Tag::Boolean) return ret.boolean;
-        if (ret.tag == Tag::Number) return ret.num != 0.0;
-        if (ret.tag == Tag::Nil) return false;
-        return false;
+        bool ok = handler_result_bool(ret);
+        if (raw) *raw = std::move(ret);
+        return ok;
     }
     catch (const std::exception &e)
     {
@@ -281,10 +342,10 @@ int RunController::run_tests()
         if (m->bytecode.handler_index.count("UTest"))
         {
             ++total;
-            bool ok = call_handler_bool(m, "UTest");
+            Value raw;
+            bool ok = call_handler_bool(m, "UTest", &raw);
             if (!ok)
             {
-                Value raw = vm.execute_handler(m, "UTest");
                 errlog(
                     "[UTest FAILED] module=" + m->name +
                     " expected=true got=" + value_debug(raw)
@@ -311,6 +372,13 @@ int RunController::run_benchmarks()
     {
         if (m->bytecode.handler_index.count("UBenchmark"))
         {
+            // time the run, not the first-call compiles; a handler that
+            // does not compile throws again when called, and is reported then
+            for (auto &f : m->bytecode.funcs)
+            {
+                try { ensure_compiled(m->bytecode, f, vm.host); }
+                catch (const std::exception &) {}
+            }
             auto t0 = chrono::steady_clock::now();
             call_handler_void(m, "UBenchmark");
             auto t1 = chrono::steady_clock::now();
@@ -319,6 +387,8 @@ int RunController::run_benchmarks()
         }
     }
     cout << "Benchmarks:\n";
+    if (!scripts_map.empty())
+        cout << "  startup (" << scripts_map.size() << " scripts): " << fixed << setprecision(3) << load_ms << " ms\n";
     for (auto &r : results)
         cout << "  " << r.module << ": " << fixed << setprecision(3) << r.ms << " ms\n";
     return 0;
@@ -331,6 +401,193 @@ int RunController::run_production()
     return 0;
 }
 
+// Static census of adjacent opcode pairs across every loaded handler, to
+// pick superinstruction candidates. Pairs whose second instruction is a
+// jump target are skipped since they can never be fused.
+int RunController::run_opcode_pairs()
+{
+    vector<Module*> mods;
+    {
+        lock_guard<mutex> lk(G_MODULES.modules_mtx);
+        for (auto &kv : G_MODULES.modules) mods.push_back(kv.second);
+    }
+
+    size_t total_ops = 0, total_pairs = 0, funcs = 0, consts = 0;
+    vector<size_t> singles(OP_COUNT, 0);
+    vector<size_t> pairs((size_t)OP_COUNT * OP_COUNT, 0);
+    for (auto *m : mods)
+    {
+        if (m->bytecode.consts) consts += m->bytecode.consts->size();
+        for (auto &f : m->bytecode.funcs)
+        {
+            ++funcs;
+            vector<bool> target(f.code.size() + 1, false);
+            for (auto &op : f.code)
+                if (is_jump_op(op.op) && op.a >= 0 && (size_t)op.a < target.size()) target[op.a] = true;
+
+            for (size_t ip = 0; ip < f.code.size(); ++ip)
+            {
+                ++total_ops;
+                ++singles[f.code[ip].op];
+                if (ip + 1 < f.code.size() && !target[ip + 1])
+                {
+                    ++total_pairs;
+                    ++pairs[(size_t)f.code[ip].op * OP_COUNT + f.code[ip + 1].op];
+                }
+            }
+        }
+    }
+
+    auto pct = [](size_t n, size_t total) { return total ? 100.0 * (double)n / (double)total : 0.0; };
+    vector<pair<size_t, size_t>> ranked;
+    for (size_t i = 0; i < pairs.size(); ++i)
+        if (pairs[i]) ranked.push_back({pairs[i], i});
+    sort(ranked.rbegin(), ranked.rend());
+
+    cout << "Opcode pairs: " << mods.size() << " modules, " << funcs << " handlers, "
+         << total_ops << " instructions, " << total_pairs << " fusible pairs, " << consts << " constants\n";
+    for (size_t i = 0; i < ranked.size() && i < 25; ++i)
+    {
+        OpCode first = (OpCode)(ranked[i].second / OP_COUNT);
+        OpCode second = (OpCode)(ranked[i].second % OP_COUNT);
+        cout << "  " << setw(16) << left << opcode_name(first) << " -> " << setw(16) << opcode_name(second)
+             << right << setw(8) << ranked[i].first << "  " << fixed << setprecision(1)
+             << pct(ranked[i].first, total_pairs) << "%\n";
+    }
+    cout << "Opcodes:\n";
+    for (size_t i = 0; i < singles.size(); ++i)
+        if (singles[i])
+            cout << "  " << setw(16) << left << opcode_name((OpCode)i) << right << setw(8) << singles[i]
+                 << "  " << fixed << setprecision(1) << pct(singles[i], total_ops) << "%\n";
+    return 0;
+}
+
+// Differential test of the JIT: every UTest and UBenchmark handler runs
+// once interpreted and once with every function jitted on first entry,
+// and the two results (or exception messages) must agree.
+int RunController::run_jit_diff()
+{
+#if !MONDOT_JIT_ENABLED
+    errlog("--jit-diff needs a build with -DMONDOT_JIT=ON on Linux x86-64");
+    return 1;
+#else
+    vector<Module*> mods;
+    {
+        lock_guard<mutex> lk(G_MODULES.modules_mtx);
+        for (auto &kv : G_MODULES.modules) mods.push_back(kv.second);
+    }
+
+    auto outcome = [this](Module *m, const string &handler, JitMode jit) -> string
+    {
+        vm.set_jit_mode(jit);
+        try
+        {
+            return value_debug(vm.execute_handler(m, handler));
+        }
+        catch (const std::exception &e)
+        {
+            return string("threw: ") + e.what();
+        }
+        catch (...)
+        {
+            return "threw: unknown exception";
+        }
+    };
+
+    JitMode saved = vm.get_jit_mode();
+    size_t total = 0, matched = 0, mismatched = 0;
+    for (auto *m : mods)
+    {
+        for (const char *handler : {"UTest", "UBenchmark"})
+        {
+            if (!m->bytecode.handler_index.count(handler)) continue;
+            ++total;
+            string interpreted = outcome(m, handler, JitMode::Off);
+            string jitted = outcome(m, handler, JitMode::Eager);
+            if (interpreted == jitted) ++matched;
+            else
+            {
+                errlog(
+                    "[JIT MISMATCH] module=" + m->name + " handler=" + handler +
+                    " interpreted=" + interpreted + " jitted=" + jitted
+                );
+                ++mismatched;
+            }
+        }
+    }
+    vm.set_jit_mode(saved);
+
+    size_t funcs = 0, jitted = 0;
+    for (auto *m : mods)
+        for (auto &f : m->bytecode.funcs)
+        {
+            ++funcs;
+            if (f.jit) ++jitted;
+        }
+    cout << "JIT diff: total=" << total << " matched=" << matched << " mismatched=" << mismatched
+         << " (" << jitted << " of " << funcs << " handlers jitted)\n";
+    return (mismatched==0) ? 0 : 2;
+#endif
+}
+
+// Compiles every script under scripts_dir and builds them into one shared
+// object for --aot-lib. Nothing is installed or run.
+int RunController::run_aot()
+{
+    vector<fs::path> paths;
+    for (auto &ent : fs::recursive_directory_iterator(scripts_dir))
+        if (ent.is_regular_file() && is_script_ext(ent.path())) paths.push_back(ent.path());
+    sort(paths.begin(), paths.end());
+
+    vector<CompiledUnit> units;
+    string source;
+    try
+    {
+        for (auto &p : paths)
+            for (CompiledUnit &cu : compile_script(p)) units.push_back(std::move(cu));
+        source = aot_emit_source(units);
+    }
+    catch (const std::exception &e)
+    {
+        errlog(string("AOT: ") + e.what());
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    if (!aot_build_library(source, aot_out)) return 1;
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    info("AOT: built " + aot_out + " from " + to_string(units.size()) + " units (" + to_string(paths.size()) +
+         " scripts) in " + to_string(secs) + "s");
+    return 0;
+}
+
+// Compiles every script under scripts_dir and prints what type inference
+// found in each handler; nothing is installed or run.
+int RunController::run_types()
+{
+    vector<fs::path> paths;
+    for (auto &ent : fs::recursive_directory_iterator(scripts_dir))
+        if (ent.is_regular_file() && is_script_ext(ent.path())) paths.push_back(ent.path());
+    sort(paths.begin(), paths.end());
+
+    compile_opts.types = &cout;
+    int failed = 0;
+    for (auto &p : paths)
+    {
+        try
+        {
+            compile_script(p);
+        }
+        catch (const std::exception &e)
+        {
+            errlog(string("compile error for ") + p.string() + ": " + e.what());
+            ++failed;
+        }
+    }
+    compile_opts.types = nullptr;
+    return failed ? 1 : 0;
+}
+
 void RunController::record_new_script(const fs::path &p)
 {
     try
@@ -343,7 +600,25 @@ void RunController::record_new_script(const fs::path &p)
 
 int RunController::run()
 {
-    initial_scan_and_load();
+    // the fixtures UTest handlers use, for the modes that run them and the
+    // ones that only compile, so the tests build there too; never where
+    // scripts run for real. Before anything compiles, since calls need them
+    if (mode != Mode::Watch && mode != Mode::Benchmark && mode != Mode::Production)
+        mondot_host::register_test_host_functions(vm.host);
+
+    if (mode == Mode::Aot) return run_aot();
+    if (mode == Mode::Types) return run_types();
+
+    // watch mode always interprets, so that edits keep hot-reloading
+    if (!aot_lib.empty() && mode != Mode::Watch)
+    {
+        if (!load_aot_library()) return 1;
+    }
+    else
+    {
+        if (!aot_lib.empty()) info("--aot-lib is ignored in watch mode");
+        initial_scan_and_load();
+    }
 
     switch (mode)
     {
@@ -356,6 +631,13 @@ int RunController::run()
             return run_benchmarks();
         case Mode::Production:
             return run_production();
+        case Mode::OpcodePairs:
+            return run_opcode_pairs();
+        case Mode::JitDiff:
+            return run_jit_diff();
+        case Mode::Aot:
+        case Mode::Types:
+            break;
     }
 
     info("MonDot runtime watching " + scripts_dir + " - press Enter to exit");
@@ -12,7 +12,7 @@
 class RunController
 {
 public:
-    enum class Mode { Watch, Test, Benchmark, Production };
+    enum class Mode { Watch, Test, Benchmark, Production, OpcodePairs, JitDiff, Aot, Types };
 
     RunController(VM &vm, const std::string &scripts_dir, int argc, char **argv);
     ~RunController();
@@ -23,6 +23,11 @@ private:
     VM &vm;
     std::string scripts_dir;
     Mode mode = Mode::Watch;
+    CompileOptions compile_opts;
+    bool eager = false;     // --eager: compile every handler of the initial scan up front
+    double load_ms = 0;     // initial_scan_and_load, for --benchmark
+    std::string aot_out;    // --aot: library to build
+    std::string aot_lib;    // --aot-lib: library to run instead of the scripts
 
     std::unordered_map<std::string, ScriptFile> scripts_map;
 
@@ -34,6 +39,9 @@ private:
 
     void initial_scan_and_load();
     void compile_and_register(const std::filesystem::path &path, bool is_new);
+    std::vector<CompiledUnit> compile_script(const std::filesystem::path &path);
+    void install_module(Module *m, bool is_new);
+    bool load_aot_library();
 
     void start_watcher();
     void watcher_loop();
@@ -41,8 +49,12 @@ private:
     int run_tests();
     int run_benchmarks();
     int run_production();
+    int run_opcode_pairs();
+    int run_jit_diff();
+    int run_aot();
+    int run_types();
 
-    bool call_handler_bool(Module *m, const std::string &handler_name);
+    bool call_handler_bool(Module *m, const std::string &handler_name, Value *raw = nullptr);
     void call_handler_void(Module *m, const std::string &handler_name);
 
     bool call_finalize_all();
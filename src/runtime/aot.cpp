@@ -0,0 +1,350 @@
+#include "aot.h"
+#include "module.h"
+#include "util.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#if !defined(_WIN32)
+  #include <dlfcn.h>
+#endif
+
+using namespace std;
+
+#ifndef MONDOT_SOURCE_DIR
+  #define MONDOT_SOURCE_DIR "src"
+#endif
+
+// s as a C++ string literal; octal escapes keep embedded NULs and
+// anything outside printable ASCII
+static string cpp_literal(const string &s)
+{
+    string out = "\"";
+    for(unsigned char ch : s)
+    {
+        if(ch == '\\' || ch == '"') { out += '\\'; out += (char)ch; }
+        else if(ch >= 0x20 && ch < 0x7f && ch != '?') out += (char)ch;
+        else
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\%03o", ch);
+            out += buf;
+        }
+    }
+    return out + "\"";
+}
+
+static string cpp_string(const string &s)
+{
+    return "std::string(" + cpp_literal(s) + ", " + to_string(s.size()) + ")";
+}
+
+static string cpp_value(const Value &v)
+{
+    switch(v.tag())
+    {
+        case Tag::Nil: return "Value()";
+        case Tag::Boolean: return v.boolean() ? "Value::make_boolean(true)" : "Value::make_boolean(false)";
+        case Tag::String: return "Value::make_interned(" + cpp_string(v.str()) + ")";
+        case Tag::Rule:
+            return "Value::make_rule(Rule{" + to_string(v.rule().type) + ", " + to_string(v.rule().id) + "u})";
+        case Tag::Number: break;
+    }
+    double d = v.num();
+    if(std::isnan(d)) return "Value::make_number(std::numeric_limits<double>::quiet_NaN())";
+    if(std::isinf(d))
+        return d > 0 ? "Value::make_number(std::numeric_limits<double>::infinity())"
+                     : "Value::make_number(-std::numeric_limits<double>::infinity())";
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%a", d);     // exact
+    return string("Value::make_number(") + buf + ")";
+}
+
+// One ByteFunc as a C++ function. s[] is the operand stack and l[] the
+// locals; the depth of every ip is static, so each instruction turns into
+// a statement on fixed slots.
+static void emit_function(ostringstream &o, const ByteModule &bm, size_t fi)
+{
+    const ByteFunc &f = bm.funcs[fi];
+    vector<int> depth = stack_depths(f);
+    vector<bool> target(f.code.size() + 1, false);
+    for(const Op &op : f.code)
+        if(is_jump_op(op.op) && op.a >= 0 && (size_t)op.a < target.size()) target[op.a] = true;
+
+    auto fail = [&](size_t ip, const string &why)
+    {
+        throw runtime_error("cannot lower " + bm.name + " function " + to_string(fi) + " at ip " +
+                            to_string(ip) + ": " + why);
+    };
+
+    string F = "f" + to_string(fi);
+    o << "static Value " << F << "(AotContext &cx, Value *args, int nargs)\n{\n";
+    o << "    Depth depth(cx);\n";
+    o << "    Value l[" << max<size_t>(f.locals.size(), 1) << "];\n";
+    o << "    Value s[" << max<size_t>(f.max_stack, 1) << "];\n";
+    o << "    params(l, " << f.nparams << ", args, nargs);\n";
+
+    for(size_t ip = 0; ip < f.code.size(); ++ip)
+    {
+        if(target[ip]) o << "L" << ip << ":\n";
+        int d = depth[ip];
+        if(d < 0) continue;
+        const Op &op = f.code[ip];
+        OpCode g = generic_opcode(op.op);
+        int n = op.a;
+        auto need = [&](int k) { if(d < k) fail(ip, "stack underflow"); };
+        auto S = [&](int i) { return "s[" + to_string(i) + "]"; };
+        auto L = [&](int i)
+        {
+            if(i < 0 || (size_t)i >= f.locals.size()) fail(ip, "bad local");
+            return "l[" + to_string(i) + "]";
+        };
+        auto K = [&](int i)
+        {
+            if(i < 0 || !bm.consts || (size_t)i >= bm.consts->size()) fail(ip, "bad constant");
+            return "K[" + to_string(i) + "]";
+        };
+        auto jump = [&](int to)
+        {
+            if(to < 0 || (size_t)to >= f.code.size()) fail(ip, "bad jump");
+            return "goto L" + to_string(to) + ";";
+        };
+        string OPN = string("OP_") + opcode_name(g);
+
+        o << "    ";
+        switch(g)
+        {
+            case OP_NOP: o << ";"; break;
+            case OP_PUSH_CONST: o << S(d) << " = " << K(op.a) << ";"; break;
+            case OP_PUSH_LOCAL: o << S(d) << " = " << L(op.a) << ";"; break;
+            case OP_PUSH_LOCAL_MOVE: o << S(d) << " = std::move(" << L(op.a) << ");"; break;
+            case OP_STORE_LOCAL: need(1); o << L(op.a) << " = std::move(" << S(d - 1) << ");"; break;
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+                need(2); o << (op.c ? "arith_nn(" : "arith(") << OPN << ", " << S(d - 2) << ", " << S(d - 1) << ");"; break;
+            case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+                need(2); o << (op.c ? "compare_nn(" : "compare(") << OPN << ", " << S(d - 2) << ", " << S(d - 1) << ");"; break;
+            case OP_NOT:
+                need(1); o << S(d - 1) << " = Value::make_boolean(!is_truthy(" << S(d - 1) << "));"; break;
+            case OP_NEG:
+                need(1);
+                o << S(d - 1) << " = Value::make_number(" << S(d - 1) << ".is_number() ? -" << S(d - 1)
+                  << ".num() : 0.0);";
+                break;
+            case OP_POP: need(n); o << "drop(&" << S(d - n) << ", " << n << ");"; break;
+            case OP_CALL:
+                need(n);
+                if(op.b < bm.funcs.size())
+                    o << S(d - n) << " = call(f" << op.b << ", cx, &" << S(d - n) << ", " << n << ");";
+                else o << "drop(&" << S(d - n) << ", " << n << ");";
+                break;
+            case OP_CALL_DYNAMIC:
+                need(n + 1);
+                o << S(d - 1 - n) << " = call_dynamic(FUNCS, " << bm.funcs.size() << ", cx, &" << S(d - 1 - n)
+                  << ", " << n << ");";
+                break;
+            case OP_CALL_HOST: case OP_CALL_HOST_NUM: case OP_CALL_HOST_POP:
+                need(n);
+                if(op.b >= f.host_calls.size()) fail(ip, "bad host call site");
+                if(g != OP_CALL_HOST_POP) o << S(d - n) << " = ";
+                o << "call_host(cx, S" << fi << "[" << op.b << "], " << OPN << ", " << (op.c ? "true" : "false")
+                  << ", &" << S(d - n) << ", " << n << ");";
+                break;
+            case OP_JMP: o << jump(op.a); break;
+            case OP_JMP_IF_FALSE: need(1); o << "if(!pop_truthy(" << S(d - 1) << ")) " << jump(op.a); break;
+            case OP_JMP_IF_TRUE: need(1); o << "if(pop_truthy(" << S(d - 1) << ")) " << jump(op.a); break;
+            case OP_RET:
+                if(d > 0) o << "return std::move(" << S(d - 1) << ");";
+                else o << "return Value();";
+                break;
+            case OP_RET_CONST: o << "return " << K(op.a) << ";"; break;
+            case OP_ITER_PREP:
+                need(1);
+                o << "iter_prep(" << L(op.a) << ", " << L(op.a + 1) << ", " << S(d - 1) << ");";
+                break;
+            case OP_FORPREP:
+                need(3);
+                L(op.b + 3);
+                o << "if(!for_prep(&" << L(op.b) << ", &" << S(d - 3) << ")) " << jump(op.a);
+                break;
+            case OP_FORLOOP:
+                L(op.b + 3);
+                o << "if(for_loop(&" << L(op.b) << ")) " << jump(op.a);
+                break;
+            case OP_ITER_NEXT:
+                o << "if(!iter_next(" << L(op.b) << ", " << L(op.b + 1) << ", " << S(d) << ")) " << jump(op.a);
+                break;
+            case OP_PUSH_LOCAL2: o << S(d) << " = " << L(op.a) << "; " << S(d + 1) << " = " << L(op.b) << ";"; break;
+            case OP_STORE_CONST: o << L(op.a) << " = " << K(op.b) << ";"; break;
+            case OP_MOVE_LOCAL: o << L(op.a) << " = " << L(op.b) << ";"; break;
+            case OP_INC_LOCAL: o << "inc(" << L(op.a) << ", " << K(op.b) << ");"; break;
+            case OP_TEST_LT_LK: case OP_TEST_LE_LK: case OP_TEST_GT_LK:
+            case OP_TEST_GE_LK: case OP_TEST_EQ_LK: case OP_TEST_NE_LK:
+                o << "if(!test_local_const(" << OPN << ", " << L(op.b) << ", " << K(op.c) << ")) " << jump(op.a);
+                break;
+            default:
+                fail(ip, string("unsupported opcode ") + opcode_name(op.op));
+        }
+        o << "\n";
+    }
+    if(target[f.code.size()]) o << "L" << f.code.size() << ":\n";
+    o << "    return Value();\n}\n\n";
+}
+
+string aot_emit_source(const vector<CompiledUnit> &units)
+{
+    ostringstream o;
+    o << "// generated by mondot --aot, do not edit\n";
+    o << "#include \"runtime/aot.h\"\n\n";
+    o << "using namespace mondot_aot;\n\n";
+
+    for(size_t ui = 0; ui < units.size(); ++ui)
+    {
+        const ByteModule &bm = units[ui].module;
+        vector<string> names(bm.funcs.size());
+        for(auto &kv : bm.handler_index)
+            if(kv.second >= 0 && (size_t)kv.second < names.size()) names[kv.second] = kv.first;
+
+        o << "// unit " << bm.name << "\n";
+        o << "namespace u" << ui << "\n{\n\n";
+        o << "static Value K[] = {\n";
+        if(!bm.consts || bm.consts->size() == 0) o << "    Value(),\n";
+        else
+            for(size_t i = 0; i < bm.consts->size(); ++i) o << "    " << cpp_value((*bm.consts)[i]) << ",\n";
+        o << "};\n\n";
+
+        for(size_t fi = 0; fi < bm.funcs.size(); ++fi)
+        {
+            o << "static Value f" << fi << "(AotContext &cx, Value *args, int nargs);\n";
+            const ByteFunc &f = bm.funcs[fi];
+            if(f.host_calls.empty()) continue;
+            o << "static HostCallSite S" << fi << "[] = {";
+            for(size_t i = 0; i < f.host_calls.size(); ++i)
+                o << (i ? ", " : " ") << "{" << cpp_string(f.host_calls[i].name) << "}";
+            o << " };\n";
+        }
+        o << "\nstatic const AotFn FUNCS[] = {";
+        for(size_t fi = 0; fi < bm.funcs.size(); ++fi) o << (fi ? ", " : " ") << "f" << fi;
+        if(bm.funcs.empty()) o << " nullptr";
+        o << " };\n\n";
+
+        for(size_t fi = 0; fi < bm.funcs.size(); ++fi) emit_function(o, bm, fi);
+
+        o << "static const AotHandler HANDLERS[] = {\n";
+        for(size_t fi = 0; fi < bm.funcs.size(); ++fi)
+            o << "    { " << cpp_literal(names[fi]) << ", f" << fi << ", " << bm.funcs[fi].nparams << " },\n";
+        if(bm.funcs.empty()) o << "    { \"\", nullptr, 0 },\n";
+        o << "};\n\n}\n\n";
+    }
+
+    o << "static const AotUnit UNITS[] = {\n";
+    for(size_t ui = 0; ui < units.size(); ++ui)
+        o << "    { " << cpp_literal(units[ui].module.name) << ", u" << ui << "::HANDLERS, "
+          << units[ui].module.funcs.size() << " },\n";
+    if(units.empty()) o << "    { \"\", nullptr, 0 },\n";
+    o << "};\n\n";
+    o << "extern \"C\" const AotLibrary *" MONDOT_AOT_ENTRY "()\n{\n";
+    o << "    static const AotLibrary lib{AOT_ABI_VERSION, sizeof(Value), UNITS, " << units.size() << "};\n";
+    o << "    return &lib;\n}\n";
+    return o.str();
+}
+
+#if !defined(_WIN32)
+
+bool aot_build_library(const string &source, const string &out_path)
+{
+    string cpp_path = out_path + ".cpp";
+    {
+        ofstream out(cpp_path, ios::binary | ios::trunc);
+        out << source;
+        if(!out)
+        {
+            errlog("AOT: cannot write " + cpp_path);
+            return false;
+        }
+    }
+
+    const char *cxx = getenv("MONDOT_CXX");
+    const char *flags = getenv("MONDOT_CXXFLAGS");
+    string src_dir = MONDOT_SOURCE_DIR;
+    string cmd = string(cxx && *cxx ? cxx : "c++") + " -std=c++17 -O3 -shared -fPIC" +
+                 // lets the inline runtime helpers inline across the library
+                 " -fno-semantic-interposition -fvisibility-inlines-hidden" +
+                 " -I'" + src_dir + "' -I'" + src_dir + "/runtime'" +
+                 (flags ? string(" ") + flags : string()) +
+                 " -o '" + out_path + "' '" + cpp_path + "'";
+    dbg("AOT: " + cmd);
+    int rc = system(cmd.c_str());
+    if(rc != 0)
+    {
+        errlog("AOT: compiler failed (" + to_string(rc) + "): " + cmd);
+        return false;
+    }
+    return true;
+}
+
+vector<Module*> aot_load_library(const string &path)
+{
+    vector<Module*> out;
+    // the library stays loaded for the life of the process: its constants
+    // and code are referenced by every Module built from it
+    void *h = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!h)
+    {
+        const char *e = dlerror();
+        errlog("AOT: cannot load " + path + ": " + (e ? e : "unknown error"));
+        return out;
+    }
+    auto entry = (const AotLibrary *(*)())dlsym(h, MONDOT_AOT_ENTRY);
+    const AotLibrary *lib = entry ? entry() : nullptr;
+    if(!lib)
+    {
+        errlog("AOT: " + path + " is not a mondot AOT library");
+        return out;
+    }
+    if(lib->abi != AOT_ABI_VERSION || lib->value_size != sizeof(Value))
+    {
+        errlog("AOT: " + path + " was built for a different mondot (abi " + to_string(lib->abi) + ")");
+        return out;
+    }
+
+    for(size_t ui = 0; ui < lib->count; ++ui)
+    {
+        const AotUnit &u = lib->units[ui];
+        Module *m = new Module();
+        m->name = u.name;
+        m->bytecode.name = u.name;
+        m->bytecode.consts = make_shared<ConstPool>();
+        m->bytecode.funcs.resize(u.count);
+        for(size_t fi = 0; fi < u.count; ++fi)
+        {
+            const AotHandler &hd = u.handlers[fi];
+            ByteFunc &f = m->bytecode.funcs[fi];
+            f.consts = m->bytecode.consts;
+            f.nparams = hd.nparams;
+            f.native = hd.fn;
+            // no code for the JIT to look at
+            f.jit_unsupported = true;
+            if(*hd.name) m->bytecode.handler_index[hd.name] = (int)fi;
+        }
+        out.push_back(m);
+    }
+    return out;
+}
+
+#else
+
+bool aot_build_library(const string &, const string &)
+{
+    errlog("AOT: not supported on this platform");
+    return false;
+}
+
+vector<Module*> aot_load_library(const string &)
+{
+    errlog("AOT: not supported on this platform");
+    return {};
+}
+
+#endif
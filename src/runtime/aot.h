@@ -0,0 +1,255 @@
+#ifndef MONDOT_AOT_H
+#define MONDOT_AOT_H
+
+#include "value.h"
+#include "host.h"
+#include "bytecode.h"
+#include "vm_ops.h"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Ahead-of-time compilation of units to a shared object.
+//
+// `mondot <dir> --aot <out.so>` compiles every unit as usual, lowers each
+// ByteFunc to a C++ function (aot_emit_source) and has the system compiler
+// build <out.so> from it. `--aot-lib <lib.so>` then installs the library's
+// units into G_MODULES instead of compiling the scripts: each handler is a
+// ByteFunc with no code and a native entry, which VM::execute_handler_idx
+// calls directly.
+//
+// The lowering keeps the bytecode's shape: locals and the operand stack
+// become fixed arrays of Values (every ip has one static stack depth, so
+// each slot is a constant index), jumps become gotos, and every opcode
+// calls the inline helpers below, which share vm_ops.h with the
+// interpreter. Handler calls inside a unit are direct C++ calls on the
+// native stack, still bounded by the VM's call depth limit. A library is
+// loaded once and never unloaded, and watch mode ignores it: hot reload
+// always goes through the interpreter.
+//
+// The generated code is compiled against these headers and links against
+// the mondot executable itself (built with ENABLE_EXPORTS), so a library
+// only loads into the build it was generated by: AOT_ABI_VERSION and a
+// check of sizeof(Value) guard the obvious mismatches.
+
+// bumped whenever the opcode numbering or the helpers below change
+constexpr uint32_t AOT_ABI_VERSION = 6;
+#define MONDOT_AOT_ENTRY "mondot_aot_library"
+
+// per call from the VM into a library. AotFn (bytecode.h) moves its args
+// from; the caller drops what is left of them.
+struct AotContext
+{
+    HostBridge *host = nullptr;
+    size_t depth = 0;
+    size_t max_depth = 0;
+};
+
+struct AotHandler
+{
+    const char *name;
+    AotFn fn;
+    uint32_t nparams;
+};
+
+struct AotUnit
+{
+    const char *name;
+    const AotHandler *handlers;
+    size_t count;
+};
+
+struct AotLibrary
+{
+    uint32_t abi;
+    uint32_t value_size;
+    const AotUnit *units;
+    size_t count;
+};
+
+// C++ source of one shared object holding every unit in units
+std::string aot_emit_source(const std::vector<CompiledUnit> &units);
+
+// writes source next to out_path (as out_path + ".cpp") and runs the
+// system compiler ($MONDOT_CXX, else c++, plus $MONDOT_CXXFLAGS) on it;
+// errors go to errlog
+bool aot_build_library(const std::string &source, const std::string &out_path);
+
+struct Module;
+
+// dlopens path and builds one Module per unit in it; empty on failure
+std::vector<Module*> aot_load_library(const std::string &path);
+
+// Runtime support for the generated code. Everything here is inline, so
+// it is compiled into the library.
+namespace mondot_aot
+{
+    // one handler activation, with the VM's call depth limit
+    struct Depth
+    {
+        AotContext &cx;
+        explicit Depth(AotContext &c): cx(c)
+        {
+            if(cx.depth >= cx.max_depth)
+                throw std::runtime_error("call depth limit of " + std::to_string(cx.max_depth) + " exceeded");
+            ++cx.depth;
+        }
+        ~Depth() { --cx.depth; }
+    };
+
+    inline void params(Value *locals, uint32_t nparams, Value *args, int nargs)
+    {
+        for(int i = 0; i < nargs && (uint32_t)i < nparams; ++i) locals[i] = std::move(args[i]);
+    }
+
+    inline void drop(Value *v, int n)
+    {
+        for(int i = 0; i < n; ++i) v[i] = Value();
+    }
+
+    // ADD..MOD on two numbers, as the compiler proved them to be where it
+    // sets op.c; b is a number, so there is nothing to release
+    inline void arith_nn(OpCode op, Value &a, const Value &b)
+    {
+        double x = a.num(), y = b.num(), r;
+        switch(op)
+        {
+            case OP_ADD: r = x + y; break;
+            case OP_SUB: r = x - y; break;
+            case OP_MUL: r = x * y; break;
+            case OP_DIV: r = y != 0.0 ? x / y : 0.0; break;
+            default:     r = y != 0.0 ? std::fmod(x, y) : 0.0; break;
+        }
+        a = Value::make_number(r);
+    }
+
+    // ADD..MOD; op is always a constant, so this folds to one operation
+    inline void arith(OpCode op, Value &a, Value &b)
+    {
+        if(a.is_number() && b.is_number())
+        {
+            arith_nn(op, a, b);
+            return;
+        }
+        a = arith_slow(op, a, b);
+        b = Value();
+    }
+
+    // LT..NE on two numbers (op.c set)
+    inline void compare_nn(OpCode op, Value &a, const Value &b)
+    {
+        double x = a.num(), y = b.num();
+        bool r;
+        switch(op)
+        {
+            case OP_LT: r = x <  y; break;
+            case OP_LE: r = x <= y; break;
+            case OP_GT: r = x >  y; break;
+            case OP_GE: r = x >= y; break;
+            case OP_EQ: r = x == y; break;
+            default:    r = x != y; break;
+        }
+        a = Value::make_boolean(r);
+    }
+
+    // LT..NE: a becomes the boolean
+    inline void compare(OpCode op, Value &a, Value &b)
+    {
+        a = Value::make_boolean(test_local_const((OpCode)(OP_TEST_LT_LK + (op - OP_LT)), a, b));
+        b = Value();
+    }
+
+    inline bool pop_truthy(Value &v)
+    {
+        bool t = is_truthy(v);
+        v = Value();
+        return t;
+    }
+
+    inline void iter_prep(Value &seq, Value &idx, Value &v)
+    {
+        seq = std::move(v);
+        idx = Value::make_number(0.0);
+    }
+
+    // ITER_NEXT: false once seq is exhausted, else out is the next char
+    inline bool iter_next(const Value &seq, Value &idx, Value &out)
+    {
+        size_t i = (size_t)idx.num();
+        if(!seq.is_string() || i >= seq.str().size()) return false;
+        out = char_string((unsigned char)seq.str()[i]);
+        idx = Value::make_number((double)(i + 1));
+        return true;
+    }
+
+    // FORPREP on h = counter, limit, step, variable and r = start, limit, step
+    inline bool for_prep(Value *h, Value *r)
+    {
+        bool run = for_enters(r[0], r[1], r[2]);
+        if(run)
+        {
+            h[0] = r[0];
+            h[1] = r[1];
+            h[2] = r[2];
+            h[3] = r[0];
+        }
+        drop(r, 3);
+        return run;
+    }
+
+    inline bool for_loop(Value *h)
+    {
+        double step = h[2].num();
+        double i = h[0].num() + step;
+        if(!for_continues(i, h[1].num(), step)) return false;
+        h[0] = Value::make_number(i);
+        h[3] = Value::make_number(i);
+        return true;
+    }
+
+    inline void inc(Value &x, const Value &k)
+    {
+        if(x.is_number() && k.is_number()) x = Value::make_number(x.num() + k.num());
+        else x = arith_slow(OP_ADD, x, k);
+    }
+
+    // CALL_HOST / CALL_HOST_NUM / CALL_HOST_POP, as the interpreter does it
+    inline Value call_host(AotContext &cx, HostCallSite &site, OpCode op, bool checked, Value *args, int nargs)
+    {
+        HostSlot *slot = cx.host->site_slot(site);
+        ArgSpan span{args, (size_t)nargs};
+        Value r;
+        if(!slot) r = Value::make_nil();
+        else if(op == OP_CALL_HOST_NUM && slot->unboxed && slot->sig.argc == nargs &&
+                (!checked || all_numbers(span)))
+            r = Value::make_number(slot->unboxed(args));
+        else r = slot->call(span);
+        drop(args, nargs);
+        return r;
+    }
+
+    inline Value call(AotFn fn, AotContext &cx, Value *args, int nargs)
+    {
+        Value r = fn(cx, args, nargs);
+        drop(args, nargs);
+        return r;
+    }
+
+    // CALL_DYNAMIC: the callee index is in args[nargs]
+    inline Value call_dynamic(const AotFn *funcs, size_t count, AotContext &cx, Value *args, int nargs)
+    {
+        Value callee = std::move(args[nargs]);
+        int idx = callee.is_number() ? (int)callee.num() : -1;
+        if(idx < 0 || (size_t)idx >= count)
+        {
+            drop(args, nargs);
+            return Value();
+        }
+        return call(funcs[idx], cx, args, nargs);
+    }
+}
+
+#endif
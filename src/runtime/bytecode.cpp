@@ -4,7 +4,12 @@
 #include <unordered_map>
 #include <string>
 #include <functional>
+#include <algorithm>
+#include <ostream>
 #include "host_manifest.h"
+#include "optimizer.h"
+#include "ssa.h"
+#include "verifier.h"
 
 using namespace std;
 
@@ -14,286 +19,786 @@ static int try_get_local(const unordered_map<string,int> &local_index, const str
     return it == local_index.end() ? -1 : it->second;
 }
 
-static int push_const(ByteFunc &bf, const Value &v)
+static OpCode unary_opcode(const string &op)
 {
-    bf.consts.push_back(v);
-    return (int)bf.consts.size() - 1;
+    if(op == "!") return OP_NOT;
+    if(op == "-") return OP_NEG;
+    throw runtime_error("unsupported unary operator '" + op + "'");
 }
 
-CompiledUnit compile_unit(UnitDecl *u)
+static OpCode binary_opcode(const string &op)
 {
-    ByteModule mod; mod.name = u->name;
-    CompiledUnit cu; cu.module = mod;
+    static const unordered_map<string, OpCode> table = {
+        {"+", OP_ADD}, {"-", OP_SUB}, {"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD},
+        {"<", OP_LT}, {"<=", OP_LE}, {">", OP_GT}, {">=", OP_GE},
+        {"==", OP_EQ}, {"!=", OP_NE},
+    };
+    auto it = table.find(op);
+    if(it == table.end()) throw runtime_error("unsupported binary operator '" + op + "'");
+    return it->second;
+}
 
-    for(auto &hptr : u->handlers)
-    {
-        HandlerDecl *h = hptr.get();
-        ByteFunc bf;
-        unordered_map<string,int> local_index;
-
-        auto add_local = [&](const string &name)->int {
-            if(local_index.count(name)) return local_index.at(name);
-            int id = (int)bf.locals.size();
-            bf.locals.push_back(name);
-            local_index[name] = id;
-            return id;
-        };
+int ConstPool::add(const Value &v)
+{
+    // a non-interned string may equal another one with different bits;
+    // it just doesn't get shared
+    auto it = index.find(v.raw_bits());
+    if(it != index.end()) return it->second;
+    int i = (int)values.size();
+    if(cap && values.size() == cap) throw ConstPoolFull();
+    values.push_back(v);
+    index.emplace(v.raw_bits(), i);
+    count.store(values.size(), memory_order_release);
+    return i;
+}
 
-        add_local("_tmp");
+static int push_const(ByteFunc &bf, const Value &v)
+{
+    return bf.consts->add(v);
+}
 
-        auto emit = [&](const Op &op){ bf.code.push_back(op); };
+// handlers of a unit can call each other directly; a later handler with
+// the same name wins, as in handler_index
+static unordered_map<string,int> handler_ids_of(const UnitDecl *u)
+{
+    unordered_map<string,int> handler_ids;
+    for(size_t i = 0; i < u->handlers.size(); ++i)
+        handler_ids[u->handlers[i]->name] = (int)i;
+    return handler_ids;
+}
 
-        // compile expression
-        function<void(Expr*)> compile_expr;
-        compile_expr = [&](Expr* e)
+// the code of handler hi of u into bf, whose consts are set; optimized as
+// opts asks, verified by the caller once every CALL target exists
+static void compile_handler(const UnitDecl *u, size_t hi, const unordered_map<string,int> &handler_ids,
+                            const CompileOptions &opts, ByteFunc &bf)
+{
+    HandlerDecl *h = u->handlers[hi].get();
+    unordered_map<string,int> local_index;
+
+    // Locals are block scoped: the handler body, every if / elseif /
+    // else arm and every loop body is a scope, and the slots a scope
+    // took are free again once it closes. Slots are handed out as a
+    // stack, so disjoint blocks share them and the frame only holds
+    // what can be live at once; bf.locals names each slot after every
+    // local that used it. A declaration always stores (nil when there
+    // is no initializer), so a reused slot is never read stale.
+    struct Scope
+    {
+        size_t first_slot;
+        vector<pair<string,int>> decls;     // name, binding it shadows (-1 if none)
+    };
+    vector<Scope> scopes;
+    size_t live_slots = 0;
+
+    auto open_scope = [&]() { scopes.push_back(Scope{live_slots, {}}); };
+    auto close_scope = [&]()
+    {
+        Scope &sc = scopes.back();
+        for(auto it = sc.decls.rbegin(); it != sc.decls.rend(); ++it)
+        {
+            if(it->second >= 0) local_index[it->first] = it->second;
+            else local_index.erase(it->first);
+        }
+        live_slots = sc.first_slot;
+        scopes.pop_back();
+    };
+
+    // a redeclaration in the same scope keeps its slot, one in an inner
+    // scope shadows the outer local until that scope closes
+    auto add_local = [&](const string &name)->int {
+        Scope &sc = scopes.back();
+        for(auto &d : sc.decls)
+            if(d.first == name) return local_index.at(name);
+        int id = (int)live_slots++;
+        if((size_t)id == bf.locals.size()) bf.locals.push_back(name);
+        else if(("|" + bf.locals[id] + "|").find("|" + name + "|") == string::npos)
+            bf.locals[id] += "|" + name;
+        sc.decls.push_back({name, try_get_local(local_index, name)});
+        local_index[name] = id;
+        return id;
+    };
+
+    // params occupy the first slots, where the caller's args land
+    open_scope();
+    for(auto &p : h->params)
+    {
+        if(local_index.count(p)) throw runtime_error("handler '" + h->name + "' repeats parameter '" + p + "'");
+        add_local(p);
+    }
+    bf.nparams = (uint32_t)h->params.size();
+
+    auto emit = [&](const Op &op){ bf.code.push_back(op); };
+
+    // Whether e always evaluates to a Number: NUM_NEVER, NUM_ALWAYS for
+    // literals and arithmetic (everything but '+' yields a Number whatever
+    // its operands), NUM_BOUND when that also rests on a host binding
+    // publishing a Number result, which stops holding if the name is
+    // re-registered. Locals are untyped, so an identifier never qualifies.
+    enum { NUM_NEVER, NUM_ALWAYS, NUM_BOUND };
+    function<int(Expr*)> static_number;
+    static_number = [&](Expr* e)->int
+    {
+        switch(e->kind)
         {
-            switch(e->kind)
+            case Expr::KNumber: return NUM_ALWAYS;
+            case Expr::KUnary: return e->op == "-" ? NUM_ALWAYS : NUM_NEVER;
+            case Expr::KBinary: {
+                if(e->op != "+")
+                    return (e->op == "-" || e->op == "*" || e->op == "/" || e->op == "%") ? NUM_ALWAYS : NUM_NEVER;
+                int l = static_number(e->args[0].get());
+                int r = static_number(e->args[1].get());
+                return (l == NUM_NEVER || r == NUM_NEVER) ? NUM_NEVER : max(l, r);
+            }
+            case Expr::KConditional: {
+                int l = static_number(e->args[1].get());
+                int r = static_number(e->args[2].get());
+                return (l == NUM_NEVER || r == NUM_NEVER) ? NUM_NEVER : max(l, r);
+            }
+            case Expr::KCall: {
+                if(try_get_local(local_index, e->call_name) >= 0 || handler_ids.count(e->call_name)) return NUM_NEVER;
+                HostSignature sig;
+                bool num = HostManifest::signature(e->call_name, sig) && sig.result == HostType::Number;
+                return num ? NUM_BOUND : NUM_NEVER;
+            }
+            default: return NUM_NEVER;
+        }
+    };
+
+    // one call site per host function name; resolved when the module is loaded
+    unordered_map<string,int> host_site_index;
+    // typed: static_number of the args taken together
+    auto emit_host_call = [&](const string &name, int nargs, int typed = NUM_NEVER)
+    {
+        auto it = host_site_index.find(name);
+        int site = 0;
+        if(it != host_site_index.end()) site = it->second;
+        else
+        {
+            site = (int)bf.host_calls.size();
+            HostCallSite hs;
+            hs.name = name;
+            bf.host_calls.push_back(hs);
+            host_site_index[name] = site;
+        }
+        if(typed == NUM_NEVER) emit(Op(OP_CALL_HOST, nargs, site));
+        else emit(Op(OP_CALL_HOST_NUM, nargs, site, typed == NUM_BOUND));
+    };
+
+    auto patch = [&](const vector<size_t> &jumps)
+    {
+        for(size_t jp : jumps) bf.code[jp].a = (int)bf.code.size();
+    };
+
+    // compile expression
+    function<void(Expr*)> compile_expr;
+
+    // Code for e used as a condition: jumps when its truthiness is
+    // 'when', adding the jump to 'jumps' for the caller to patch, and
+    // falls through otherwise. and / or / not never materialize a
+    // boolean here, and the right operand of and / or is skipped once
+    // the left one decides.
+    function<void(Expr*, bool, vector<size_t>&)> compile_branch;
+    compile_branch = [&](Expr* e, bool when, vector<size_t> &jumps)
+    {
+        if(e->kind == Expr::KUnary && e->op == "!")
+        {
+            compile_branch(e->args[0].get(), !when, jumps);
+            return;
+        }
+        if(e->kind == Expr::KLogical)
+        {
+            // a jump out of the whole expression when the left operand
+            // alone decides it, else past it to the right operand
+            bool decides = e->op == "or";
+            if(decides == when)
             {
-                case Expr::KBoolean: {
-                    int ci = push_const(bf, Value::make_boolean(e->num));
-                    emit(Op(OP_PUSH_CONST, ci, 0));
-                    break;
+                compile_branch(e->args[0].get(), when, jumps);
+                compile_branch(e->args[1].get(), when, jumps);
+                return;
+            }
+            vector<size_t> skip;
+            compile_branch(e->args[0].get(), !when, skip);
+            compile_branch(e->args[1].get(), when, jumps);
+            patch(skip);
+            return;
+        }
+        compile_expr(e);
+        emit(Op(when ? OP_JMP_IF_TRUE : OP_JMP_IF_FALSE, 0, 0));
+        jumps.push_back(bf.code.size()-1);
+    };
+
+    compile_expr = [&](Expr* e)
+    {
+        switch(e->kind)
+        {
+            case Expr::KBoolean: {
+                int ci = push_const(bf, Value::make_boolean(e->num != 0.0));
+                emit(Op(OP_PUSH_CONST, ci, 0));
+                break;
+            }
+            case Expr::KNumber: {
+                int ci = push_const(bf, Value::make_number(e->num));
+                emit(Op(OP_PUSH_CONST, ci, 0));
+                break;
+            }
+            case Expr::KNil: {
+                int ci = push_const(bf, Value::make_nil());
+                emit(Op(OP_PUSH_CONST, ci, 0));
+                break;
+            }
+            case Expr::KString: {
+                int ci = push_const(bf, Value::make_interned(e->str));
+                emit(Op(OP_PUSH_CONST, ci, 0));
+                break;
+            }
+            case Expr::KIdent: {
+                int lid = try_get_local(local_index, e->ident);
+                if(lid >= 0) emit(Op(OP_PUSH_LOCAL, lid, 0));
+                else throw runtime_error(
+                        string("unresolved identifier '") + e->ident +
+                        "': globals are not allowed; declare as local or pass as parameter"
+                    );
+                break;
+            }
+            case Expr::KCall: {
+                // compile args left-to-right
+                for(auto &a : e->args) compile_expr(a.get());
+
+                int lid = try_get_local(local_index, e->call_name);
+                auto hit = handler_ids.find(e->call_name);
+                if(lid >= 0)
+                {
+                    emit(Op(OP_PUSH_LOCAL, lid, 0));
+                    emit(Op(OP_CALL_DYNAMIC, (int)e->args.size(), 0));
                 }
-                case Expr::KNumber: {
-                    int ci = push_const(bf, Value::make_number(e->num));
-                    emit(Op(OP_PUSH_CONST, ci, 0));
-                    break;
+                else if(hit != handler_ids.end())
+                {
+                    // missing args are nil, extra ones are dropped
+                    emit(Op(OP_CALL, (int)e->args.size(), hit->second));
                 }
-                case Expr::KNil: {
-                    int ci = push_const(bf, Value::make_nil());
-                    emit(Op(OP_PUSH_CONST, ci, 0));
+                else
+                {
+                    HostSignature sig;
+                    if (HostManifest::signature(e->call_name, sig))
+                    {
+                        // a numeric binding called with statically numeric
+                        // args takes the unboxed entry, skipping the thunk
+                        int typed = (sig.all_numeric() && sig.argc == (int)e->args.size()) ? NUM_ALWAYS : NUM_NEVER;
+                        for(auto &a : e->args)
+                        {
+                            if(typed == NUM_NEVER) break;
+                            int k = static_number(a.get());
+                            typed = k == NUM_NEVER ? NUM_NEVER : max(typed, k);
+                        }
+                        emit_host_call(e->call_name, (int)e->args.size(), typed);
+                    }
+                    else
+                    {
+                        throw runtime_error(
+                            string("unresolved function '") + e->call_name +
+                            "': globals not allowed; assign function to local variable or import explicitly"
+                        );
+                    }
+                }
+                break;
+            }
+            case Expr::KUnary: {
+                compile_expr(e->args[0].get());
+                emit(Op(unary_opcode(e->op), 0, 0));
+                break;
+            }
+            case Expr::KBinary: {
+                // lhs first, so rhs ends up on top of the stack
+                compile_expr(e->args[0].get());
+                compile_expr(e->args[1].get());
+                emit(Op(binary_opcode(e->op), 0, 0));
+                break;
+            }
+            case Expr::KLogical: {
+                // always a boolean, whatever the operands are
+                vector<size_t> to_false;
+                compile_branch(e, false, to_false);
+                emit(Op(OP_PUSH_CONST, push_const(bf, Value::make_boolean(true)), 0));
+                size_t end_jump = bf.code.size();
+                emit(Op(OP_JMP, 0, 0));
+                patch(to_false);
+                emit(Op(OP_PUSH_CONST, push_const(bf, Value::make_boolean(false)), 0));
+                bf.code[end_jump].a = (int)bf.code.size();
+                break;
+            }
+            case Expr::KConditional: {
+                // only the chosen operand is evaluated
+                vector<size_t> to_else;
+                compile_branch(e->args[0].get(), false, to_else);
+                compile_expr(e->args[1].get());
+                size_t end_jump = bf.code.size();
+                emit(Op(OP_JMP, 0, 0));
+                patch(to_else);
+                compile_expr(e->args[2].get());
+                bf.code[end_jump].a = (int)bf.code.size();
+                break;
+            }
+            case Expr::KCallExpr: {
+                // TODO
+                throw runtime_error("KCallExpr unsupported in this compile path");
+            }
+            case Expr::KFuncLiteral: {
+                // TODO.
+                throw runtime_error("function literal not supported in this compiler (closures not implemented)");
+            }
+            default:
+                throw runtime_error("unsupported expr kind in compile_expr");
+        }
+    };
+
+    function<void(const vector<unique_ptr<Stmt>>&)> compile_block;
+    auto compile_scope = [&](const vector<unique_ptr<Stmt>> &stmts)
+    {
+        open_scope();
+        compile_block(stmts);
+        close_scope();
+    };
+    compile_block = [&](const vector<unique_ptr<Stmt>> &stmts)
+    {
+        for(size_t si=0; si<stmts.size(); ++si) {
+            Stmt *st = stmts[si].get();
+            switch(st->kind) {
+                case Stmt::KLocalDecl: {
+                    // local declaration: expected fields local_name, local_init (Expr*)
+                    if(!st->local_name.size()) throw runtime_error("local decl requires name");
+                    if(st->local_init) {
+                        compile_expr(st->local_init.get());
+                    } else {
+                        int ci = push_const(bf, Value::make_nil());
+                        emit(Op(OP_PUSH_CONST, ci, 0));
+                    }
+                    int lid = add_local(st->local_name);
+                    emit(Op(OP_STORE_LOCAL, lid, 0));
                     break;
                 }
-                case Expr::KString: {
-                    int ci = push_const(bf, Value::make_string(e->str));
-                    emit(Op(OP_PUSH_CONST, ci, 0));
+                case Stmt::KAssign: {
+                    // assignment: lhs (string), rhs (Expr*)
+                    if(!st->lhs.size()) throw runtime_error("assign requires lhs");
+                    compile_expr(st->rhs.get());
+                    
+                    int lid = try_get_local(local_index, st->lhs);
+                    if(lid < 0) throw runtime_error(string("assign to undeclared name '") + st->lhs + "': declare as local first");
+                    emit(Op(OP_STORE_LOCAL, lid, 0));
                     break;
                 }
-                case Expr::KIdent: {
-                    int lid = try_get_local(local_index, e->ident);
-                    if(lid >= 0) emit(Op(OP_PUSH_LOCAL, lid, 0));
-                    else throw runtime_error(
-                            string("unresolved identifier '") + e->ident +
-                            "': globals are not allowed; declare as local or pass as parameter"
-                        );
+                case Stmt::KExpr: {
+                    // expression statement: e.g., function call
+                    if(!st->expr) throw runtime_error("expr stmt without expression");
+                    if(st->expr->kind != Expr::KCall) throw runtime_error("expr stmt must be a call in this prototype");
+                    // compile call & drop return
+                    compile_expr(st->expr.get());
+                    emit(Op(OP_POP, 1, 0));
                     break;
                 }
-                case Expr::KCall: {
-                    // compile args left-to-right
-                    for(auto &a : e->args) compile_expr(a.get());
-
-                    int lid = try_get_local(local_index, e->call_name);
-                    if(lid >= 0)
+                case Stmt::KIf: {
+                    // if statement with optional elseif parts and else
+                    // fields: cond (Expr*), then_body (vector<Stmt>), elseif_parts (vector<pair<Expr*, vector<Stmt>>>), else_body (vector<Stmt>)
+                    // jumps to after then when the condition is false
+                    vector<size_t> to_next;
+                    compile_branch(st->cond.get(), false, to_next);
+
+                    // then body
+                    compile_scope(st->then_body);
+
+                    // after then, jump to after all else/elseif; every arm
+                    // gets one, patched once the end is known
+                    vector<size_t> end_jumps;
+                    emit(Op(OP_JMP, 0, 0));
+                    end_jumps.push_back(bf.code.size()-1);
+
+                    // fix them to the current pos (start of elseif/else)
+                    patch(to_next);
+
+                    // elseif parts
+                    for(auto &ep : st->elseif_parts)
                     {
-                        emit(Op(OP_PUSH_LOCAL, lid, 0));
-                        emit(Op(OP_CALL, (int)e->args.size(), -2));
+                        // ep.first = cond (unique_ptr<Expr>), ep.second = vector<unique_ptr<Stmt>>
+                        vector<size_t> to_next2;
+                        compile_branch(ep.first.get(), false, to_next2);
+
+                        compile_scope(ep.second);
+
+                        emit(Op(OP_JMP, 0, 0));
+                        end_jumps.push_back(bf.code.size()-1);
+
+                        // fix them to current pos
+                        patch(to_next2);
                     }
-                    else
+
+                    // else
+                    if(!st->else_body.empty())
                     {
-                        if (HostManifest::has(e->call_name))
-                        {
-                            Op call(OP_CALL, (int)e->args.size(), -1);
-                            call.s = e->call_name;
-                            emit(call);
-                        }
-                        else
-                        {
-                            throw runtime_error(
-                                string("unresolved function '") + e->call_name +
-                                "': globals not allowed; assign function to local variable or import explicitly"
-                            );
-                        }
+                        compile_scope(st->else_body);
                     }
+
+                    patch(end_jumps);
+                    break;
+                }
+                case Stmt::KWhile: {
+                    // fields: cond (Expr*), then_body (vector<Stmt>)
+                    size_t loop_start = bf.code.size();
+                    vector<size_t> to_exit;
+                    compile_branch(st->cond.get(), false, to_exit);
+
+                    compile_scope(st->then_body);
+
+                    // jump back to loop start
+                    emit(Op(OP_JMP, (int)loop_start, 0));
+
+                    // fix the exits to after loop
+                    patch(to_exit);
                     break;
                 }
-                case Expr::KCallExpr: {
-                    // TODO
-                    throw runtime_error("KCallExpr unsupported in this compile path");
+                case Stmt::KForeach: {
+                    // fields: iter_name (string), iter_expr (Expr*), foreach_body (vector<Stmt>)
+                    // strings iterate byte by byte (ITER_PREP / ITER_NEXT), anything
+                    // else zero times. The sequence and the index live in a pair of
+                    // hidden locals of the loop's scope, named so that no identifier
+                    // can refer to them; the scope also holds the variable and the body.
+                    compile_expr(st->iter_expr.get());
+                    open_scope();
+                    int seq_local = add_local("(foreach seq)");
+                    add_local("(foreach idx)");     // always seq_local + 1
+                    if((size_t)seq_local + 1 > MAX_B_OPERAND)
+                        throw runtime_error("handler '" + h->name + "' has too many locals for foreach");
+                    emit(Op(OP_ITER_PREP, seq_local, 0));
+
+                    // next char onto the stack, or leave the loop
+                    size_t loop_ip = bf.code.size();
+                    emit(Op(OP_ITER_NEXT, 0, seq_local));
+                    int itlid = add_local(st->iter_name);
+                    emit(Op(OP_STORE_LOCAL, itlid, 0));
+
+                    compile_block(st->foreach_body);
+                    close_scope();
+
+                    emit(Op(OP_JMP, (int)loop_ip, 0));
+                    bf.code[loop_ip].a = (int)bf.code.size();
+                    break;
                 }
-                case Expr::KFuncLiteral: {
-                    // TODO.
-                    throw runtime_error("function literal not supported in this compiler (closures not implemented)");
+                case Stmt::KFor: {
+                    // fields: iter_name, range_start, range_limit, range_step (optional),
+                    // foreach_body. Counter, limit and step live in three hidden locals,
+                    // and the loop variable in a fourth right after them, all in the
+                    // loop's scope with the body. FORLOOP steps the counter, tests
+                    // it against the limit and copies it to the variable in one
+                    // instruction; assigning to the variable does not change the
+                    // iteration.
+                    compile_expr(st->range_start.get());
+                    compile_expr(st->range_limit.get());
+                    if(st->range_step) compile_expr(st->range_step.get());
+                    else emit(Op(OP_PUSH_CONST, push_const(bf, Value::make_number(1)), 0));
+
+                    open_scope();
+                    int base = add_local("(for counter)");
+                    add_local("(for limit)");       // base + 1
+                    add_local("(for step)");        // base + 2
+                    add_local(st->iter_name);       // base + 3
+                    if((size_t)base + 3 > MAX_B_OPERAND)
+                        throw runtime_error("handler '" + h->name + "' has too many locals for for");
+
+                    size_t prep_ip = bf.code.size();
+                    emit(Op(OP_FORPREP, 0, base));
+                    size_t body_ip = bf.code.size();
+
+                    compile_block(st->foreach_body);
+                    close_scope();
+
+                    emit(Op(OP_FORLOOP, (int)body_ip, base));
+                    bf.code[prep_ip].a = (int)bf.code.size();
+                    break;
+                }
+                case Stmt::KReturn: {
+                    // fields: expr
+                    compile_expr(st->expr.get());
+                    emit(Op(OP_RET,0,0));
+                    break;
                 }
                 default:
-                    throw runtime_error("unsupported expr kind in compile_expr");
+                    throw runtime_error("unsupported stmt kind in compile_unit");
             }
-        };
+        }
+    };
 
-        function<void(const vector<unique_ptr<Stmt>>&)> compile_block;
-        compile_block = [&](const vector<unique_ptr<Stmt>> &stmts)
-        {
-            for(size_t si=0; si<stmts.size(); ++si) {
-                Stmt *st = stmts[si].get();
-                switch(st->kind) {
-                    case Stmt::KLocalDecl: {
-                        // local declaration: expected fields local_name, local_init (Expr*)
-                        if(!st->local_name.size()) throw runtime_error("local decl requires name");
-                        if(st->local_init) {
-                            compile_expr(st->local_init.get());
-                        } else {
-                            int ci = push_const(bf, Value::make_nil());
-                            emit(Op(OP_PUSH_CONST, ci, 0));
-                        }
-                        int lid = add_local(st->local_name);
-                        emit(Op(OP_STORE_LOCAL, lid, 0));
-                        break;
-                    }
-                    case Stmt::KAssign: {
-                        // assignment: lhs (string), rhs (Expr*)
-                        if(!st->lhs.size()) throw runtime_error("assign requires lhs");
-                        compile_expr(st->rhs.get());
-                        
-                        int lid = try_get_local(local_index, st->lhs);
-                        if(lid < 0) throw runtime_error(string("assign to undeclared name '") + st->lhs + "': declare as local first");
-                        emit(Op(OP_STORE_LOCAL, lid, 0));
-                        break;
-                    }
-                    case Stmt::KExpr: {
-                        // expression statement: e.g., function call
-                        if(!st->expr) throw runtime_error("expr stmt without expression");
-                        if(st->expr->kind != Expr::KCall) throw runtime_error("expr stmt must be a call in this prototype");
-                        // compile call & drop return
-                        compile_expr(st->expr.get());
-                        emit(Op(OP_POP, 1, 0));
-                        break;
-                    }
-                    case Stmt::KIf: {
-                        // if statement with optional elseif parts and else
-                        // fields: cond (Expr*), then_body (vector<Stmt>), elseif_parts (vector<pair<Expr*, vector<Stmt>>>), else_body (vector<Stmt>)
-                        compile_expr(st->cond.get());
-                        // emit JMP_IF_FALSE to after then
-                        Op jif(OP_JMP_IF_FALSE, 0, 0);
-                        emit(jif);
-                        size_t jif_pos = bf.code.size()-1;
-
-                        // then body
-                        compile_block(st->then_body);
-
-                        // after then, jump to after all else/elseif
-                        Op jmp(OP_JMP, 0, 0);
-                        emit(jmp);
-                        size_t jmp_pos = bf.code.size()-1;
-
-                        // fix jif target to current pos (start of elseif/else)
-                        bf.code[jif_pos].a = (int)bf.code.size();
-
-                        // elseif parts
-                        for(auto &ep : st->elseif_parts)
-                        {
-                            // ep.first = cond (unique_ptr<Expr>), ep.second = vector<unique_ptr<Stmt>>
-                            compile_expr(ep.first.get());
-                            Op jif2(OP_JMP_IF_FALSE, 0, 0);
-                            emit(jif2);
-                            size_t jif2_pos = bf.code.size()-1;
-
-                            compile_block(ep.second);
-
-                            Op jmp2(OP_JMP, 0, 0);
-                            emit(jmp2);
-                            size_t jmp2_pos = bf.code.size()-1;
-
-                            // fix jif2 to current pos
-                            bf.code[jif2_pos].a = (int)bf.code.size();
-                            // leave jmp2 target to be fixed by outer logic later; for simplicity set to current pos for now
-                            bf.code[jmp2_pos].a = (int)bf.code.size();
-                        }
-
-                        // else
-                        if(!st->else_body.empty())
-                        {
-                            compile_block(st->else_body);
-                        }
+    compile_block(h->body);
+    emit(Op(OP_RET,0,0));
 
-                        // fix jmp (after then) to current pos
-                        bf.code[jmp_pos].a = (int)bf.code.size();
-                        break;
-                    }
-                    case Stmt::KWhile: {
-                        // fields: cond (Expr*), then_body (vector<Stmt>)
-                        size_t loop_start = bf.code.size();
-                        compile_expr(st->cond.get());
-                        Op jif(OP_JMP_IF_FALSE, 0, 0);
-                        emit(jif);
-                        size_t jif_pos = bf.code.size()-1;
-
-                        compile_block(st->then_body);
-
-                        // jump back to loop start
-                        emit(Op(OP_JMP, (int)loop_start, 0));
-
-                        // fix jif to after loop
-                        bf.code[jif_pos].a = (int)bf.code.size();
-                        break;
-                    }
-                    case Stmt::KForeach: {
-                        // fields: iter_name (string), iter_expr (Expr*), foreach_body (vector<Stmt>)
-                        // only string iteration is supported via host helpers strlen, str_char_at, add, lt
-                        compile_expr(st->iter_expr.get());
-                        int seq_local = add_local("__foreach_seq");
-                        emit(Op(OP_STORE_LOCAL, seq_local, 0));
-
-                        int idx_local = add_local("__foreach_idx");
-                        int ci0 = push_const(bf, Value::make_number(0));
-                        emit(Op(OP_PUSH_CONST, ci0, 0));
-                        emit(Op(OP_STORE_LOCAL, idx_local, 0));
-
-                        size_t loop_ip = bf.code.size();
-
-                        // call strlen(seq)
-                        emit(Op(OP_PUSH_LOCAL, seq_local, 0));
-                        { Op calllen(OP_CALL, 1, -1); calllen.s = "strlen"; emit(calllen); }
-                        // push idx; compare idx < len via host lt(idx, len)
-                        emit(Op(OP_PUSH_LOCAL, idx_local, 0));
-                        { Op calllt(OP_CALL, 2, -1); calllt.s = "lt"; emit(calllt); }
-                        Op jif2(OP_JMP_IF_FALSE, 0, 0); emit(jif2);
-                        size_t jif2_pos = bf.code.size()-1;
-
-                        // str_char_at(seq, idx)
-                        emit(Op(OP_PUSH_LOCAL, seq_local, 0));
-                        emit(Op(OP_PUSH_LOCAL, idx_local, 0));
-                        { Op callchar(OP_CALL, 2, -1); callchar.s = "str_char_at"; emit(callchar); }
-
-                        // store into foreach var
-                        int itlid = add_local(st->iter_name);
-                        emit(Op(OP_STORE_LOCAL, itlid, 0));
-
-                        // body
-                        compile_block(st->foreach_body);
-
-                        // idx = add(idx, 1)
-                        emit(Op(OP_PUSH_LOCAL, idx_local, 0));
-                        int ci1 = push_const(bf, Value::make_number(1));
-                        emit(Op(OP_PUSH_CONST, ci1, 0));
-                        { Op calladd(OP_CALL, 2, -1); calladd.s = "add"; emit(calladd); }
-                        emit(Op(OP_STORE_LOCAL, idx_local, 0));
-
-                        // jump back
-                        emit(Op(OP_JMP, (int)loop_ip, 0));
-
-                        // fix jif2 -> exit
-                        bf.code[jif2_pos].a = (int)bf.code.size();
-                        break;
-                    }
-                    case Stmt::KReturn: {
-                        // fields: expr
-                        compile_expr(st->expr.get());
-                        emit(Op(OP_RET,0,0));
-                        break;
-                    }
-                    default:
-                        throw runtime_error("unsupported stmt kind in compile_unit");
-                }
-            }
-        };
+    if(bf.host_calls.size() > MAX_B_OPERAND)
+        throw runtime_error("handler '" + h->name + "' calls too many distinct host functions");
 
-        compile_block(h->body);
-        emit(Op(OP_RET,0,0));
+    if(opts.types) *opts.types << u->name << " " << h->name << ":\n";
+    if(opts.opt_level >= 2) optimize_ssa(bf, opts.types);
+    else if(opts.types) *opts.types << "  (types are inferred at -O2)\n";
+    if(opts.opt_level >= 1) optimize_jumps(bf);
+    if(opts.opt_level >= 2)
+    {
+        fuse_superinstructions(bf);
+        move_last_uses(bf);
+    }
+    bf.deopts.assign(bf.code.size(), 0);
+}
 
-        // push bf into module
+CompiledUnit compile_unit(shared_ptr<UnitDecl> u, const CompileOptions &opts)
+{
+    CompiledUnit cu;
+    cu.module.name = u->name;
+    shared_ptr<LazyConsts> lazy_consts;
+    if(opts.lazy) lazy_consts = make_shared<LazyConsts>();
+    else cu.module.consts = make_shared<ConstPool>();
+    if(u->handlers.size() > MAX_B_OPERAND + 1)
+        throw runtime_error("unit '" + u->name + "' has too many handlers");
+
+    unordered_map<string,int> handler_ids = handler_ids_of(u.get());
+    for(size_t i = 0; i < u->handlers.size(); ++i)
+    {
+        ByteFunc bf;
+        if(opts.lazy)
+        {
+            bf.lazy = make_shared<LazyHandler>();
+            bf.lazy->unit = u;
+            bf.lazy->handler = i;
+            bf.lazy->opts = opts;
+            bf.lazy->consts = lazy_consts;
+        }
+        else
+        {
+            bf.consts = cu.module.consts;
+            compile_handler(u.get(), i, handler_ids, opts, bf);
+        }
         int idx = (int)cu.module.funcs.size();
         cu.module.funcs.push_back(move(bf));
-        cu.module.handler_index[h->name] = idx;
+        cu.module.handler_index[u->handlers[i]->name] = idx;
     }
 
+    // every CALL target exists by now
+    for(size_t i = 0; i < cu.module.funcs.size(); ++i)
+        if(!cu.module.funcs[i].lazy) verify_function(cu.module, cu.module.funcs[i], u->handlers[i]->name);
+
+    // only needed while compiling
+    if(cu.module.consts)
+    {
+        cu.module.consts->index = unordered_map<uint64_t,int>();
+        for(auto &f : cu.module.funcs) f.const_data = cu.module.consts->data();
+    }
     return cu;
 }
+
+void compile_lazy_handler(const ByteModule &bm, ByteFunc &f)
+{
+    const LazyHandler &l = *f.lazy;
+    const UnitDecl *u = l.unit.get();
+    LazyConsts &lc = *l.consts;
+    lock_guard<mutex> lk(lc.mtx);
+    ByteFunc bf;
+    for(size_t room = LazyConsts::POOL_SIZE;;)
+    {
+        bool fresh = !lc.pool;
+        if(fresh) lc.pool = make_shared<ConstPool>(room);
+        bf = ByteFunc();
+        bf.consts = lc.pool;
+        try
+        {
+            compile_handler(u, l.handler, handler_ids_of(u), l.opts, bf);
+            verify_function(bm, bf, u->handlers[l.handler]->name);
+            break;
+        }
+        catch(const ConstPoolFull &)
+        {
+            // again in a fresh pool, a bigger one if this one was fresh
+            // too; what the attempt added stays behind unused. The full
+            // pool is only read from now on.
+            dbg("compile: constant pool full, " + u->handlers[l.handler]->name + " tries a fresh one");
+            if(fresh) room *= 2;
+            lc.pool->index = unordered_map<uint64_t,int>();
+            lc.pool.reset();
+        }
+        catch(const exception &e)
+        {
+            throw runtime_error("compile error in unit '" + u->name + "': " + e.what());
+        }
+    }
+
+    // everything but lazy, which other threads may be checking
+    f.code = move(bf.code);
+    f.consts = move(bf.consts);
+    f.const_data = f.consts->data();
+    f.locals = move(bf.locals);
+    f.host_calls = move(bf.host_calls);
+    f.nparams = bf.nparams;
+    f.max_stack = bf.max_stack;
+    f.deopts = move(bf.deopts);
+}
+
+int stack_effect(const Op &op)
+{
+    switch(generic_opcode(op.op))
+    {
+        case OP_PUSH_CONST:
+        case OP_PUSH_LOCAL:
+        case OP_PUSH_LOCAL_MOVE:
+            return 1;
+        case OP_PUSH_LOCAL2:
+            return 2;
+        case OP_STORE_LOCAL:
+        case OP_JMP_IF_FALSE:
+        case OP_JMP_IF_TRUE:
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+            return -1;
+        case OP_CALL:
+        case OP_CALL_HOST:
+        case OP_CALL_HOST_NUM:
+            return 1 - op.a;
+        case OP_CALL_DYNAMIC:
+            return -op.a;
+        case OP_CALL_HOST_POP:
+        case OP_POP:
+            return -op.a;
+        case OP_ITER_PREP:
+            return -1;
+        case OP_ITER_NEXT:
+            return 1;
+        case OP_FORPREP:
+            return -3;
+        default:
+            return 0;
+    }
+}
+
+int branch_stack_effect(const Op &op)
+{
+    return op.op == OP_ITER_NEXT ? 0 : stack_effect(op);
+}
+
+vector<int> stack_depths(const ByteFunc &f)
+{
+    // verify_function has proven that every ip has a single depth, so one
+    // visit per ip is enough
+    vector<int> depth(f.code.size(), -1);
+    if(f.code.empty()) return depth;
+    vector<size_t> work{0};
+    depth[0] = 0;
+    while(!work.empty())
+    {
+        size_t ip = work.back();
+        work.pop_back();
+        const Op &op = f.code[ip];
+        auto flow = [&](size_t to, int effect)
+        {
+            if(to < f.code.size() && depth[to] < 0)
+            {
+                depth[to] = max(0, depth[ip] + effect);
+                work.push_back(to);
+            }
+        };
+        if(is_jump_op(op.op) && op.a >= 0) flow((size_t)op.a, branch_stack_effect(op));
+        if(op.op != OP_JMP && op.op != OP_RET && op.op != OP_RET_CONST) flow(ip + 1, stack_effect(op));
+    }
+    return depth;
+}
+
+const char *opcode_name(OpCode op)
+{
+    switch(op)
+    {
+#define MONDOT_OPCODE_NAME(name) case OP_##name: return #name;
+        MONDOT_OPCODE_LIST(MONDOT_OPCODE_NAME)
+#undef MONDOT_OPCODE_NAME
+        default: return "?";
+    }
+}
+
+static string local_name(const ByteFunc &f, int i)
+{
+    return (i >= 0 && (size_t)i < f.locals.size()) ? f.locals[i] : string("?");
+}
+
+static string const_repr(const ByteFunc &f, int i)
+{
+    if(i < 0 || (size_t)i >= f.consts->size()) return "?";
+    const Value &v = (*f.consts)[i];
+    return v.is_string() ? "'" + v.str() + "'" : value_to_string(v);
+}
+
+string disassemble_op(const ByteFunc &f, size_t ip)
+{
+    const Op &op = f.code[ip];
+    string out = opcode_name(op.op);
+    // quickened ops carry the operands of their generic form
+    switch(generic_opcode(op.op))
+    {
+        case OP_PUSH_CONST:
+            out += " " + to_string(op.a) + "  ; " + const_repr(f, op.a);
+            break;
+        case OP_PUSH_LOCAL:
+        case OP_PUSH_LOCAL_MOVE:
+        case OP_STORE_LOCAL:
+            out += " " + to_string(op.a) + "  ; " + local_name(f, op.a);
+            break;
+        case OP_CALL:
+            out += " " + to_string(op.a) + " " + to_string(op.b);
+            break;
+        case OP_CALL_DYNAMIC:
+        case OP_POP:
+        case OP_JMP:
+        case OP_JMP_IF_FALSE:
+        case OP_JMP_IF_TRUE:
+            out += " " + to_string(op.a);
+            break;
+        case OP_CALL_HOST:
+        case OP_CALL_HOST_NUM:
+        case OP_CALL_HOST_POP:
+            out += " " + to_string(op.a) + " " + to_string(op.b) + "  ; " +
+                   (op.b < f.host_calls.size() ? f.host_calls[op.b].name : string("?"));
+            if(op.op == OP_CALL_HOST_NUM && op.c) out += " (args checked)";
+            break;
+        case OP_RET_CONST:
+            out += " " + to_string(op.a) + "  ; " + const_repr(f, op.a);
+            break;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+            if(op.c) out += "  ; numbers";
+            break;
+        case OP_ITER_PREP:
+            out += " " + to_string(op.a) + "  ; " + local_name(f, op.a);
+            break;
+        case OP_ITER_NEXT:
+        case OP_FORPREP:
+        case OP_FORLOOP:
+            out += " " + to_string(op.a) + " " + to_string(op.b) + "  ; " + local_name(f, op.b);
+            break;
+        case OP_PUSH_LOCAL2:
+            out += " " + to_string(op.a) + " " + to_string(op.b) + "  ; " +
+                   local_name(f, op.a) + ", " + local_name(f, op.b);
+            break;
+        case OP_MOVE_LOCAL:
+            out += " " + to_string(op.a) + " " + to_string(op.b) + "  ; " +
+                   local_name(f, op.a) + " = " + local_name(f, op.b);
+            break;
+        case OP_STORE_CONST:
+            out += " " + to_string(op.a) + " " + to_string(op.b) + "  ; " +
+                   local_name(f, op.a) + " = " + const_repr(f, op.b);
+            break;
+        case OP_INC_LOCAL:
+            out += " " + to_string(op.a) + " " + to_string(op.b) + "  ; " +
+                   local_name(f, op.a) + " += " + const_repr(f, op.b);
+            break;
+        case OP_TEST_LT_LK:
+        case OP_TEST_LE_LK:
+        case OP_TEST_GT_LK:
+        case OP_TEST_GE_LK:
+        case OP_TEST_EQ_LK:
+        case OP_TEST_NE_LK:
+            out += " " + to_string(op.a) + " " + to_string(op.b) + " " + to_string(op.c) + "  ; " +
+                   local_name(f, op.b) + ", " + const_repr(f, op.c);
+            break;
+        default:
+            break;
+    }
+    return out;
+}
@@ -2,48 +2,284 @@
 #define MONDOT_BYTECODE_H
 
 #include "value.h"
+#include "host.h"
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include <iosfwd>
+
+// Every opcode, in encoding order. The list drives the OpCode enum, the
+// decoder and the VM's direct-threaded dispatch table.
+//
+//   PUSH_CONST      a = const idx
+//   PUSH_LOCAL      a = local idx
+//   STORE_LOCAL     a = local idx (store top)
+//   ADD .. NE       pop operands (rhs on top), push result; c = 1 when the
+//                   compiler proved both are numbers (see ssa.h), so the
+//                   JIT and AOT skip the tag checks
+//   NOT / NEG       replace top with its negated truthiness / negation
+//   CALL            a = arg count, b = func idx (a handler of the same module)
+//   CALL_DYNAMIC    a = arg count, callee (func idx) on top of the args
+//   CALL_HOST       a = arg count, b = index into ByteFunc::host_calls
+//   CALL_HOST_NUM   as CALL_HOST, for a numeric binding whose args the
+//                   compiler proved to be numbers; calls the unboxed entry.
+//                   c = 1 when that proof rests on another host binding's
+//                   result type, so the arg tags are still checked
+//   POP             a = count to pop
+//   JMP             a = target ip (absolute)
+//   JMP_IF_FALSE    a = target ip, taken when the popped value is falsy
+//   JMP_IF_TRUE     a = target ip, taken when the popped value is truthy
+//   ITER_PREP       a = the hidden local pair of a foreach: pops the
+//                   sequence into local a and sets local a+1 (the index)
+//                   to 0
+//   ITER_NEXT       a = exit ip, b = the pair ITER_PREP set up: pushes the
+//                   next one-char string of the sequence and advances the
+//                   index, or jumps to a, pushing nothing, once the
+//                   sequence is exhausted (at once if it is no string)
+//   FORPREP         a = exit ip, b = the four locals of a numeric for
+//                   (counter, limit, step, loop variable): pops start,
+//                   limit and step (step on top); when they are numbers and
+//                   the range is not empty, stores them and start as the
+//                   loop variable, else jumps to a
+//   FORLOOP         a = loop body ip, b = the four locals: adds step to the
+//                   counter and, while it has not passed the limit, copies
+//                   it to the loop variable and jumps to a
+//
+// Superinstructions, only ever produced by fuse_superinstructions (see
+// optimizer.h); their operands are validated there, once:
+//   PUSH_LOCAL2     a, b = locals pushed in that order
+//   STORE_CONST     a = local, b = const       (x = k)
+//   MOVE_LOCAL      a = dst local, b = src     (x = y)
+//   INC_LOCAL       a = local, b = const       (x = x + k)
+//   CALL_HOST_POP   as CALL_HOST, result discarded
+//   RET_CONST       a = const
+//   TEST_LT_LK ..   a = target ip taken when (local b <op> const c) is
+//   TEST_NE_LK          false, i.e. a fused compare + JMP_IF_FALSE
+//
+// Produced by move_last_uses (see optimizer.h) after fusion:
+//   PUSH_LOCAL_MOVE a = local, as PUSH_LOCAL for its last use: moves the
+//                   value onto the stack and leaves nil behind
+//
+// Quickened forms, never emitted by the compiler: the VM rewrites a generic
+// instruction in place once it has seen number operands there, and back
+// (de-quickens) when the guard fails. Operands are those of the generic op.
+//   ADD_NN .. MOD_NN    arithmetic on two numbers
+//   LT_NN .. NE_NN      compare two numbers, push the boolean
+//   JLT_NN .. JNE_NN    compare two numbers and act as the JMP_IF_FALSE
+//                       that follows (taking its target), skipping it
+//   TEST_LT_LN ..       TEST_*_LK with a number local and number const
+//   TEST_NE_LN
+#define MONDOT_OPCODE_LIST(X) \
+    X(NOP)                    \
+    X(PUSH_CONST)             \
+    X(PUSH_LOCAL)             \
+    X(STORE_LOCAL)            \
+    X(ADD)                    \
+    X(SUB)                    \
+    X(MUL)                    \
+    X(DIV)                    \
+    X(MOD)                    \
+    X(LT)                     \
+    X(LE)                     \
+    X(GT)                     \
+    X(GE)                     \
+    X(EQ)                     \
+    X(NE)                     \
+    X(NOT)                    \
+    X(NEG)                    \
+    X(CALL)                   \
+    X(CALL_DYNAMIC)           \
+    X(CALL_HOST)              \
+    X(POP)                    \
+    X(RET)                    \
+    X(JMP)                    \
+    X(JMP_IF_FALSE)           \
+    X(PUSH_LOCAL2)            \
+    X(STORE_CONST)            \
+    X(MOVE_LOCAL)             \
+    X(INC_LOCAL)              \
+    X(CALL_HOST_POP)          \
+    X(RET_CONST)              \
+    X(TEST_LT_LK)             \
+    X(TEST_LE_LK)             \
+    X(TEST_GT_LK)             \
+    X(TEST_GE_LK)             \
+    X(TEST_EQ_LK)             \
+    X(TEST_NE_LK)             \
+    X(CALL_HOST_NUM)          \
+    X(ITER_PREP)              \
+    X(ITER_NEXT)              \
+    X(FORPREP)                \
+    X(FORLOOP)                \
+    X(JMP_IF_TRUE)            \
+    X(PUSH_LOCAL_MOVE)        \
+    X(ADD_NN)                 \
+    X(SUB_NN)                 \
+    X(MUL_NN)                 \
+    X(DIV_NN)                 \
+    X(MOD_NN)                 \
+    X(LT_NN)                  \
+    X(LE_NN)                  \
+    X(GT_NN)                  \
+    X(GE_NN)                  \
+    X(EQ_NN)                  \
+    X(NE_NN)                  \
+    X(JLT_NN)                 \
+    X(JLE_NN)                 \
+    X(JGT_NN)                 \
+    X(JGE_NN)                 \
+    X(JEQ_NN)                 \
+    X(JNE_NN)                 \
+    X(TEST_LT_LN)             \
+    X(TEST_LE_LN)             \
+    X(TEST_GT_LN)             \
+    X(TEST_GE_LN)             \
+    X(TEST_EQ_LN)             \
+    X(TEST_NE_LN)
 
 enum OpCode : uint8_t
 {
-    OP_NOP = 0,
-
-    // pushing/loading
-    OP_PUSH_CONST,   // a = const idx
-    OP_PUSH_LOCAL,   // a = local idx
-    OP_STORE_LOCAL,  // a = local idx (store top)
-
-    //
-    OP_ADD,
-    OP_SUB,
-    OP_LT,
-
-    // calls / fn
-    OP_CALL,  // a = arg count, b: special (-1 host/global by name in .s, -2 dynamic callee on stack)
-    OP_POP,   // a = count to pop
-    OP_RET,
-
-    // flow control
-    OP_JMP,            // a = target ip or relative (we use absolute addresses)
-    OP_JMP_IF_FALSE,   // a = target ip
+#define MONDOT_OPCODE_ENUM(name) OP_##name,
+    MONDOT_OPCODE_LIST(MONDOT_OPCODE_ENUM)
+#undef MONDOT_OPCODE_ENUM
+    OP_COUNT
 };
 
+// Fixed-width 8-byte instruction. Everything that used to be an inline
+// string (host function names, local names) lives in a per-function side
+// table and is referenced by index. Jump targets always go in a.
 struct Op
 {
     OpCode op;
-    int a;
-    int b;
-    std::string s;
-    Op(OpCode o=OP_NOP,int A=0,int B=0): op(o), a(A), b(B){}
+    uint8_t c;
+    uint16_t b;
+    int32_t a;
+    Op(OpCode o=OP_NOP, int A=0, int B=0, int C=0): op(o), c((uint8_t)C), b((uint16_t)B), a(A) {}
+};
+
+static_assert(sizeof(Op) == 8, "Op must stay 8 bytes");
+
+inline bool is_jump_op(OpCode op)
+{
+    switch(op)
+    {
+        case OP_JMP:
+        case OP_JMP_IF_FALSE:
+        case OP_JMP_IF_TRUE:
+        case OP_ITER_NEXT:
+        case OP_FORPREP:
+        case OP_FORLOOP:
+        case OP_TEST_LT_LK:
+        case OP_TEST_LE_LK:
+        case OP_TEST_GT_LK:
+        case OP_TEST_GE_LK:
+        case OP_TEST_EQ_LK:
+        case OP_TEST_NE_LK:
+        case OP_TEST_LT_LN:
+        case OP_TEST_LE_LN:
+        case OP_TEST_GT_LN:
+        case OP_TEST_GE_LN:
+        case OP_TEST_EQ_LN:
+        case OP_TEST_NE_LN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the instruction a quickened one was rewritten from (op itself otherwise)
+inline OpCode generic_opcode(OpCode op)
+{
+    if(op >= OP_ADD_NN && op <= OP_MOD_NN) return (OpCode)(OP_ADD + (op - OP_ADD_NN));
+    if(op >= OP_LT_NN && op <= OP_NE_NN) return (OpCode)(OP_LT + (op - OP_LT_NN));
+    if(op >= OP_JLT_NN && op <= OP_JNE_NN) return (OpCode)(OP_LT + (op - OP_JLT_NN));
+    if(op >= OP_TEST_LT_LN && op <= OP_TEST_NE_LN) return (OpCode)(OP_TEST_LT_LK + (op - OP_TEST_LT_LN));
+    return op;
+}
+
+// a quickened instruction that had to be de-quickened this many times
+// stays generic: its operand types keep changing
+constexpr uint8_t QUICKEN_LIMIT = 4;
+
+// operand limits implied by the encoding
+constexpr size_t MAX_B_OPERAND = 0xffff;
+constexpr size_t MAX_C_OPERAND = 0xff;
+
+// Constants of one module, shared by all of its functions. Entries are
+// deduplicated by their bits, which identifies equal strings too since
+// compile_unit interns every string literal. The Values are built once at
+// compile time, so PUSH_CONST is a copy and never allocates.
+//
+// A pool made with a capacity reserves it up front and never grows past
+// it: add throws ConstPoolFull instead. Its Values then never move, so
+// handlers compiled on their first call can keep adding to a pool other
+// handlers are running from (see LazyConsts). size() may be read while
+// another thread adds.
+struct ConstPool
+{
+    ConstPool() = default;
+    explicit ConstPool(size_t capacity) : cap(capacity) { values.reserve(capacity); }
+
+    std::unordered_map<uint64_t,int> index;
+
+    int add(const Value &v);
+    size_t size() const { return count.load(std::memory_order_acquire); }
+    size_t capacity() const { return cap; }
+    const Value *data() const { return values.data(); }
+    const Value &operator[](size_t i) const { return values[i]; }
+
+private:
+    std::vector<Value> values;
+    size_t cap = 0;                     // 0: grows as needed
+    std::atomic<size_t> count{0};
 };
 
+// thrown by ConstPool::add on a full pool
+struct ConstPoolFull : std::runtime_error
+{
+    ConstPoolFull() : std::runtime_error("constant pool full") {}
+};
+
+struct JitCode;
+struct AotContext;
+struct LazyHandler;
+
+// entry of an ahead-of-time compiled handler (see aot.h)
+using AotFn = Value (*)(AotContext &cx, Value *args, int nargs);
+
 struct ByteFunc
 {
     std::vector<Op> code;
-    std::vector<Value> consts;
+    std::shared_ptr<ConstPool> consts;
+    // consts->data(), set once the handler's code is final
+    const Value *const_data = nullptr;
+    // one entry per frame slot, params first: its size is the most locals
+    // live at once, since block scopes share slots (see compile_unit). A
+    // shared slot is named "a|b" after every local it held.
     std::vector<std::string> locals;
+    std::vector<HostCallSite> host_calls;
+    uint32_t nparams = 0;
+    // deepest operand stack the code can reach, see verify_function
+    uint32_t max_stack = 0;
+    // per-instruction inline-cache state of the quickening VM: how often
+    // the instruction was de-quickened (one entry per op in code)
+    std::vector<uint8_t> deopts;
+    // baseline JIT state (see jit.h): calls plus loop back edges taken so
+    // far, the translated code once there is some, and whether translation
+    // was tried and declined
+    uint32_t hotness = 0;
+    bool jit_unsupported = false;
+    std::shared_ptr<JitCode> jit;
+    // set for handlers loaded from an AOT library, which have no code
+    AotFn native = nullptr;
+    // set for a handler compile_unit left to its first call
+    // (CompileOptions::lazy): until ensure_compiled (module.h) ran, it has
+    // no code, locals or consts
+    std::shared_ptr<LazyHandler> lazy;
 };
 
 struct ByteModule
@@ -51,6 +287,8 @@ struct ByteModule
     std::string name;
     std::unordered_map<std::string,int> handler_index;
     std::vector<ByteFunc> funcs;
+    // the pool of every handler, or null if compile_unit left them lazy
+    std::shared_ptr<ConstPool> consts;
 };
 
 struct CompiledUnit
@@ -60,6 +298,63 @@ struct CompiledUnit
 
 #include "ast.h"
 
-CompiledUnit compile_unit(UnitDecl *u);
+// -O0 emits the naive code as is, -O1 adds the jump/peephole pass and -O2
+// (the default) also runs the SSA pass (see ssa.h) first, then fuses
+// superinstructions and moves locals on their last use
+struct CompileOptions
+{
+    int opt_level = 2;
+    // --types: where to describe what the SSA pass inferred, per handler
+    std::ostream *types = nullptr;
+    // only record each handler's AST and compile it on its first call;
+    // compile errors then surface there instead of from compile_unit
+    bool lazy = false;
+};
+
+// Where the lazy handlers of one module put their constants: into pool
+// while it has room, then into a fresh one. A handler's constants all sit
+// in one pool, which its code indexes from const_data. mtx is held for a
+// whole compile, since that adds to the pool as it goes.
+struct LazyConsts
+{
+    // room for the constants of a few handlers: a full pool costs the
+    // handlers after it their sharing with the ones before
+    static constexpr size_t POOL_SIZE = 256;
+
+    std::mutex mtx;
+    std::shared_ptr<ConstPool> pool;    // made on the first compile
+};
+
+// A handler waiting for its first call. Its unit's AST stays alive for as
+// long as the handler does; once is what makes concurrent first calls
+// compile it exactly once, and compiled is the fast check in front of it.
+struct LazyHandler
+{
+    std::shared_ptr<UnitDecl> unit;
+    size_t handler = 0;         // index in unit->handlers
+    CompileOptions opts;
+    std::shared_ptr<LazyConsts> consts;     // the same for every handler of the module
+    std::once_flag once;
+    std::atomic<bool> compiled{false};
+};
+
+// the handlers keep u alive only when compiled lazily
+CompiledUnit compile_unit(std::shared_ptr<UnitDecl> u, const CompileOptions &opts = CompileOptions());
+// fills in f, a handler of bm compile_unit left lazy; not thread safe on
+// its own, callers go through ensure_compiled
+void compile_lazy_handler(const ByteModule &bm, ByteFunc &f);
+
+// net operand stack change of one instruction (RET and RET_CONST leave the
+// function and report 0), and the change along its jump where that differs
+// (ITER_NEXT only pushes when it falls through)
+int stack_effect(const Op &op);
+int branch_stack_effect(const Op &op);
+// operand stack depth on entry to every ip (-1 where unreachable) of a
+// verified function
+std::vector<int> stack_depths(const ByteFunc &f);
+
+// decoder
+const char *opcode_name(OpCode op);
+std::string disassemble_op(const ByteFunc &f, size_t ip);
 
 #endif
\ No newline at end of file
@@ -12,13 +12,122 @@ void HostBridge::release_rule(const Rule &r)
     // TODO
 }
 
-void HostBridge::register_function(const std::string &name, HostFn fn)
+static Value call_legacy_host_fn(ArgSpan args, void *data)
+{
+    const HostSlot *slot = static_cast<const HostSlot*>(data);
+    return slot->fn(std::vector<Value>(args.begin(), args.end()));
+}
+
+// argument values as a HostMemo key; false when some argument is a Rule
+static bool memo_key(ArgSpan args, std::string &key)
 {
+    for(const Value &v : args)
     {
-        std::unique_lock lock(fn_mtx);
-        functions[name] = std::move(fn);
+        if(v.tag() == Tag::Rule) return false;
+        if(v.is_string())
+        {
+            uint64_t len = v.str().size();
+            key += 's';
+            key.append(reinterpret_cast<const char*>(&len), sizeof(len));
+            key += v.str();
+            continue;
+        }
+        uint64_t bits = v.raw_bits();
+        key += 'v';
+        key.append(reinterpret_cast<const char*>(&bits), sizeof(bits));
+    }
+    return true;
+}
+
+static Value call_memoized(ArgSpan args, void *data)
+{
+    HostMemo &memo = *static_cast<HostMemo*>(data);
+    // one key buffer per thread, so a hit allocates nothing
+    thread_local std::string key;
+    key.clear();
+    if(!memo_key(args, key))
+    {
+        {
+            std::lock_guard lock(memo.mtx);
+            ++memo.stats.bypassed;
+        }
+        return memo.fn(args, memo.data);
+    }
+    {
+        std::lock_guard lock(memo.mtx);
+        auto it = memo.results.find(key);
+        if(it != memo.results.end())
+        {
+            ++memo.stats.hits;
+            return it->second;
+        }
+        ++memo.stats.misses;
+    }
+    // called outside the lock: a slow function does not hold up other
+    // threads, and two racing on the same key store the same result. It
+    // may call other memoized functions, which reuse the buffer.
+    std::string owned = key;
+    Value r = memo.fn(args, memo.data);
+    std::lock_guard lock(memo.mtx);
+    if(memo.results.size() >= HostMemo::CAPACITY)
+    {
+        memo.results.clear();
+        ++memo.stats.evictions;
+    }
+    memo.results.emplace(std::move(owned), r);
+    return r;
+}
+
+static void add_slot(HostBridge &host, std::unique_ptr<HostSlot> slot)
+{
+    std::string name = slot->name;
+    HostSignature sig = slot->sig;
+    const HostSlot *p = slot.get();
+    {
+        std::unique_lock lock(host.fn_mtx);
+        host.slots.push_back(std::move(slot));
+        host.functions[name] = host.slots.back().get();
+        host.version.fetch_add(1, std::memory_order_release);
+    }
+    HostManifest::register_name(name, sig, p);
+}
+
+void HostBridge::register_native(const std::string &name, NativeFn fn, void *data)
+{
+    auto slot = std::make_unique<HostSlot>();
+    slot->name = name;
+    slot->native = fn;
+    slot->data = data;
+    add_slot(*this, std::move(slot));
+}
+
+void HostBridge::register_binding(const HostBinding &b)
+{
+    auto slot = std::make_unique<HostSlot>();
+    slot->name = b.name;
+    slot->native = b.fn;
+    slot->sig = b.sig;
+    slot->unboxed = b.unboxed;
+    if(b.sig.memoize && b.sig.pure)
+    {
+        // every call goes through the cache, the unboxed entry included
+        slot->memo = std::make_unique<HostMemo>();
+        slot->memo->fn = b.fn;
+        slot->native = call_memoized;
+        slot->data = slot->memo.get();
+        slot->unboxed = nullptr;
     }
-    HostManifest::register_name(name);
+    add_slot(*this, std::move(slot));
+}
+
+void HostBridge::register_function(const std::string &name, HostFn fn)
+{
+    auto slot = std::make_unique<HostSlot>();
+    slot->name = name;
+    slot->fn = std::move(fn);
+    slot->native = call_legacy_host_fn;
+    slot->data = slot.get();
+    add_slot(*this, std::move(slot));
 }
 
 bool HostBridge::unregister_function(const std::string &name)
@@ -27,6 +136,7 @@ bool HostBridge::unregister_function(const std::string &name)
     {
         std::unique_lock lock(fn_mtx);
         erased = functions.erase(name) > 0;
+        if(erased) version.fetch_add(1, std::memory_order_release);
     }
     if(erased) HostManifest::unregister_name(name);
     return erased;
@@ -40,14 +150,37 @@ bool HostBridge::has_function(const std::string &name) const
 
 std::optional<Value> HostBridge::call_function(const std::string &name, const std::vector<Value> &args) const
 {
-    std::shared_lock lock(fn_mtx);
-    auto it = functions.find(name);
-    if(it != functions.end()) {
-        HostFn fn = it->second;
-        lock.unlock();
-        return fn(args);
+    HostSlot *slot = nullptr;
+    {
+        std::shared_lock lock(fn_mtx);
+        auto it = functions.find(name);
+        if(it == functions.end()) return std::nullopt;
+        slot = it->second;
+    }
+    return slot->call(ArgSpan{args.data(), args.size()});
+}
+
+bool HostBridge::memo_stats(const std::string &name, HostMemoStats &out) const
+{
+    HostMemo *memo = nullptr;
+    {
+        std::shared_lock lock(fn_mtx);
+        auto it = functions.find(name);
+        if(it == functions.end() || !it->second->memo) return false;
+        memo = it->second->memo.get();
     }
-    return std::nullopt;
+    std::lock_guard lock(memo->mtx);
+    out = memo->stats;
+    out.size = memo->results.size();
+    return true;
+}
+
+void HostBridge::resolve(HostCallSite &site) const
+{
+    std::shared_lock lock(fn_mtx);
+    auto it = functions.find(site.name);
+    site.slot = it == functions.end() ? nullptr : it->second;
+    site.version = version.load(std::memory_order_relaxed);
 }
 
 HostBridge GLOBAL_HOST;
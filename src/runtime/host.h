@@ -1,29 +1,137 @@
 #pragma once
 #include "value.h"
+#include "host_manifest.h"
 #include <string>
 #include <unordered_map>
 #include <functional>
 #include <vector>
+#include <memory>
 #include <atomic>
 #include <shared_mutex>
 #include <optional>
+#include <mutex>
 
+// Arguments of a host call: a non-owning view straight into the VM's value
+// stack. Nothing is copied or refcounted for the call, so the span (and
+// the Values it shows) is only valid until the host function returns.
+struct ArgSpan
+{
+    const Value *data = nullptr;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const Value &operator[](size_t i) const { return data[i]; }
+    const Value *begin() const { return data; }
+    const Value *end() const { return data + count; }
+};
+
+// native calling convention; 'data' is whatever was passed at registration
+using NativeFn = Value (*)(ArgSpan args, void *data);
+
+// legacy convention, kept working through an adapter that copies the
+// span into a vector
 using HostFn = std::function<Value(const std::vector<Value>&)>;
 
+// unboxed entry of a typed numeric binding: reads exactly sig.argc
+// arguments, already known to be numbers, with no count or tag checks
+using UnboxedFn = double (*)(const Value *args);
+
+// One entry of a registration table (see host_bind.h). Plain data, so the
+// tables of built-in functions are constexpr and cost no work at startup
+// beyond inserting the slots.
+struct HostBinding
+{
+    const char *name;
+    NativeFn fn;
+    HostSignature sig = {};
+    UnboxedFn unboxed = nullptr;
+};
+
+// what a HostMemo has done so far, see HostBridge::memo_stats
+struct HostMemoStats
+{
+    size_t hits = 0, misses = 0;
+    size_t bypassed = 0;        // calls with a Rule argument
+    size_t evictions = 0;       // times it was full and started over
+    size_t size = 0;
+};
+
+// Result cache of a memoized host function (HostSignature::memoize),
+// keyed on the argument values: numbers by their bits, strings by content.
+// Calls with a Rule argument are not cached. Bounded: once full, it starts
+// over.
+struct HostMemo
+{
+    static constexpr size_t CAPACITY = 4096;
+
+    std::mutex mtx;
+    std::unordered_map<std::string, Value> results;
+    HostMemoStats stats;        // guarded by mtx, like results
+    NativeFn fn = nullptr;      // the function behind the cache
+    void *data = nullptr;
+};
+
+// One registration of a host function. Slots are never freed while the
+// bridge lives: re-registering a name creates a new slot, so a call site
+// holding a stale pointer can still call through it safely until it notices
+// the version bump and re-resolves.
+struct HostSlot
+{
+    std::string name;
+    NativeFn native = nullptr;
+    void *data = nullptr;
+    HostFn fn;      // only for register_function slots
+    HostSignature sig;
+    UnboxedFn unboxed = nullptr;
+    std::unique_ptr<HostMemo> memo;     // then native goes through it
+
+    Value call(ArgSpan args) const { return native(args, data); }
+};
+
+// A host call site, resolved at load time and re-resolved lazily whenever
+// the bridge version changes.
+struct HostCallSite
+{
+    std::string name;
+    HostSlot *slot = nullptr;
+    uint32_t version = 0;
+};
+
 struct HostBridge
 {
     std::atomic<uint32_t> next_rule_id{1};
 
     mutable std::shared_mutex fn_mtx;
-    std::unordered_map<std::string, HostFn> functions;
+    std::unordered_map<std::string, HostSlot*> functions;
+    std::vector<std::unique_ptr<HostSlot>> slots;
+
+    // bumped by every register/unregister
+    std::atomic<uint32_t> version{1};
 
     Rule create_rule(const std::string &type);
     void release_rule(const Rule &r);
 
+    void register_native(const std::string &name, NativeFn fn, void *data = nullptr);
+    void register_binding(const HostBinding &b);
+    template<size_t N> void register_table(const HostBinding (&table)[N])
+    {
+        for(const HostBinding &b : table) register_binding(b);
+    }
     void register_function(const std::string &name, HostFn fn);
     bool unregister_function(const std::string &name);
     bool has_function(const std::string &name) const;
     std::optional<Value> call_function(const std::string &name, const std::vector<Value> &args) const;
+    // false unless name is registered memoized
+    bool memo_stats(const std::string &name, HostMemoStats &out) const;
+
+    void resolve(HostCallSite &site) const;
+
+    HostSlot *site_slot(HostCallSite &site) const
+    {
+        if(site.version != version.load(std::memory_order_acquire)) resolve(site);
+        return site.slot;
+    }
 };
 
 extern HostBridge GLOBAL_HOST;
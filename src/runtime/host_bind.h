@@ -0,0 +1,121 @@
+#pragma once
+#include "host.h"
+#include <cstddef>
+#include <utility>
+#include <tuple>
+#include <type_traits>
+
+// Typed host bindings.
+//
+//     static double m_pow(double a, double b) { return std::pow(a, b); }
+//     static constexpr HostBinding TABLE[] = { pure(bind<m_pow>("pow")), ... };
+//
+// bind<Fn> generates, at compile time, a NativeFn thunk that checks the
+// argument count and tags and converts to/from the C++ types, plus (when
+// every type is double) an unboxed entry that the VM calls directly from
+// call sites the compiler proved numeric. The signature is published to
+// the HostManifest when the table is registered.
+//
+// A bad call (too few arguments, wrong tag) returns the default of the
+// result type, which is what the hand-written math helpers always did.
+namespace mondot_bind
+{
+    template<typename T> struct host_type;
+
+    template<> struct host_type<double>
+    {
+        static constexpr HostType type = HostType::Number;
+        static bool check(const Value &v) { return v.tag() == Tag::Number; }
+        static double from(const Value &v) { return v.num(); }
+        static Value to(double d) { return Value::make_number(d); }
+    };
+
+    template<typename F> struct fn_traits;
+
+    template<typename R, typename... A> struct fn_traits<R(*)(A...)>
+    {
+        using result = R;
+        static constexpr size_t arity = sizeof...(A);
+        template<size_t I> using param = std::tuple_element_t<I, std::tuple<A...>>;
+        static constexpr bool all_double = std::is_same_v<R, double> && (std::is_same_v<A, double> && ...);
+    };
+
+    template<auto Fn> struct Thunk
+    {
+        using traits = fn_traits<decltype(Fn)>;
+        using R = typename traits::result;
+        static_assert(traits::arity <= HostSignature::MAX_PARAMS, "too many host parameters");
+
+        template<size_t... I>
+        static Value call(ArgSpan args, std::index_sequence<I...>)
+        {
+            if(args.size() < sizeof...(I)) return host_type<R>::to(R());
+            if(!(host_type<typename traits::template param<I>>::check(args[I]) && ...))
+                return host_type<R>::to(R());
+            return host_type<R>::to(Fn(host_type<typename traits::template param<I>>::from(args[I])...));
+        }
+
+        static Value native(ArgSpan args, void *)
+        {
+            return call(args, std::make_index_sequence<traits::arity>());
+        }
+
+        template<size_t... I>
+        static double call_unboxed(const Value *args, std::index_sequence<I...>)
+        {
+            return Fn(args[I].num()...);
+        }
+
+        static double unboxed(const Value *args)
+        {
+            return call_unboxed(args, std::make_index_sequence<traits::arity>());
+        }
+
+        template<size_t... I>
+        static constexpr HostSignature signature(std::index_sequence<I...>)
+        {
+            HostSignature sig;
+            sig.result = host_type<R>::type;
+            sig.argc = (int8_t)sizeof...(I);
+            ((sig.params[I] = host_type<typename traits::template param<I>>::type), ...);
+            return sig;
+        }
+    };
+
+    template<auto Fn>
+    constexpr HostBinding bind(const char *name)
+    {
+        using T = Thunk<Fn>;
+        using traits = typename T::traits;
+        UnboxedFn unboxed = nullptr;
+        if constexpr (traits::all_double) unboxed = &T::unboxed;
+        return HostBinding{name, &T::native, T::signature(std::make_index_sequence<traits::arity>()), unboxed};
+    }
+
+    // pure(bind<m_sqrt>("sqrt")): declares the binding free of side
+    // effects (HostSignature::pure), Cheap unless told otherwise; works on
+    // hand-written entries too
+    constexpr HostBinding pure(HostBinding b, HostCost cost = HostCost::Cheap)
+    {
+        b.sig.pure = true;
+        b.sig.cost = cost;
+        return b;
+    }
+
+    // returns({"strlen", fn}, HostType::Number): the result type of a
+    // hand-written entry, which bind<> works out by itself
+    constexpr HostBinding returns(HostBinding b, HostType result)
+    {
+        b.sig.result = result;
+        return b;
+    }
+
+    // memoized(bind<m_lookup>("lookup")): pure and Expensive, with results
+    // cached per argument values by the bridge (HostSignature::memoize)
+    constexpr HostBinding memoized(HostBinding b)
+    {
+        b = pure(b, HostCost::Expensive);
+        b.sig.memoize = true;
+        return b;
+    }
+}
@@ -1,4 +1,5 @@
 #include "host_core_funcs.h"
+#include "host_bind.h"
 #include <cstdio>
 #include <charconv>
 #include <random>
@@ -17,20 +18,20 @@ namespace mondot_host
 
     static inline void format_value_to_string(const Value &v, std::string &out)
     {
-        switch (v.tag)
+        switch (v.tag())
         {
             case Tag::Number: {
                 char buf[64];
-                int n = std::snprintf(buf, sizeof(buf), "%.15g", v.num);
+                int n = std::snprintf(buf, sizeof(buf), "%.15g", v.num());
                 if (n > 0) out.append(buf, (size_t)n);
                 else out.append("<badnum>");
                 break;
             }
             case Tag::String:
-                out.append(*v.s);
+                out.append(v.str());
                 break;
             case Tag::Boolean:
-                out.append(v.boolean ? "true" : "false");
+                out.append(v.boolean() ? "true" : "false");
                 break;
             case Tag::Nil:
                 out.append("nil");
@@ -43,17 +44,17 @@ namespace mondot_host
 
     static inline std::string fast_to_string(const Value &v)
     {
-        switch (v.tag) {
+        switch (v.tag()) {
             case Tag::Number: {
                 char buf[32];
-                int n = std::snprintf(buf, sizeof(buf), "%.15g", v.num);
+                int n = std::snprintf(buf, sizeof(buf), "%.15g", v.num());
                 if (n > 0) return std::string(buf, buf + n);
                 return std::string("<badnum>");
             }
             case Tag::String:
-                return *v.s;
+                return v.str();
             case Tag::Boolean:
-                return v.boolean ? "true" : "false";
+                return v.boolean() ? "true" : "false";
             case Tag::Nil:
                 return "nil";
             default:
@@ -61,7 +62,7 @@ namespace mondot_host
         }
     }
 
-    static inline void fast_print_multi(const std::vector<Value> &args, bool add_newline, bool do_flush)
+    static inline void fast_print_multi(ArgSpan args, bool add_newline, bool do_flush)
     {
         std::string buf;
         if (args.empty() && add_newline)
@@ -119,20 +120,55 @@ namespace mondot_host
         return RegisteredFunctionGuard(h, name);
     }
 
-    void register_core_host_functions(HostBridge &host)
+    // typed numeric helpers, bound through host_bind.h
+    static double m_sub(double a, double b) { return a - b; }
+    static double m_mul(double a, double b) { return a * b; }
+    static double m_div(double a, double b) { return b != 0.0 ? a / b : 0.0; }
+    static double m_lt(double a, double b) { return a < b ? 1.0 : 0.0; }
+    static double m_gt(double a, double b) { return a > b ? 1.0 : 0.0; }
+
+    // bitwise helpers (treat numbers as int64)
+    static double m_shift(double a, double b)
+    {
+        int64_t x = static_cast<int64_t>(a), n = static_cast<int64_t>(b);
+        return (n >= 0 && n < 63) ? static_cast<double>(x << n) : 0.0;
+    }
+    static double m_bitwise(double a, double b)
     {
+        int64_t x = static_cast<int64_t>(a), n = static_cast<int64_t>(b);
+        return (n >= 0 && n < 63) ? static_cast<double>(x >> n) : 0.0;
+    }
+
+    static double m_floor(double x) { return std::floor(x); }
+    static double m_ceil(double x) { return std::ceil(x); }
+    static double m_abs(double x) { return std::fabs(x); }
+    static double m_min(double a, double b) { return std::min(a, b); }
+    static double m_max(double a, double b) { return std::max(a, b); }
+    static double m_pow(double a, double b) { return std::pow(a, b); }
+    static double m_sqrt(double x) { return std::sqrt(x); }
+    static double m_sin(double x) { return std::sin(x); }
+    static double m_cos(double x) { return std::cos(x); }
+    static double m_tan(double x) { return std::tan(x); }
+    static double m_log(double x) { return std::log(x); }
+    static double m_exp(double x) { return std::exp(x); }
+
+    using mondot_bind::bind;
+    using mondot_bind::pure;
+    using mondot_bind::returns;
+
+    static constexpr HostBinding CORE_BINDINGS[] = {
         // IO
-        host.register_function("io.print", [](const std::vector<Value> &args)->Value {
+        {"io.print", [](ArgSpan args, void*)->Value {
             fast_print_multi(args, true, true);
             return Value::make_nil();
-        });
+        }},
 
-        host.register_function("io.println", [](const std::vector<Value> &args)->Value {
+        {"io.println", [](ArgSpan args, void*)->Value {
             fast_print_multi(args, true, true);
             return Value::make_nil();
-        });
+        }},
 
-        host.register_function("io.write", [](const std::vector<Value> &args)->Value {
+        {"io.write", [](ArgSpan args, void*)->Value {
             if (args.empty()) return Value::make_nil();
             std::string s;
             format_value_to_string(args[0], s);
@@ -141,9 +177,9 @@ namespace mondot_host
                 std::cout.write(s.data(), static_cast<std::streamsize>(s.size()));
             }
             return Value::make_nil();
-        });
+        }},
 
-        host.register_function("io.writeln", [](const std::vector<Value> &args)->Value {
+        {"io.writeln", [](ArgSpan args, void*)->Value {
             if (args.empty()) {
                 std::lock_guard<std::mutex> lk(io_mtx);
                 std::cout.put('\n');
@@ -157,19 +193,19 @@ namespace mondot_host
                 std::cout.write(s.data(), static_cast<std::streamsize>(s.size()));
             }
             return Value::make_nil();
-        });
+        }},
 
-        host.register_function("io.flush", [](const std::vector<Value> &args)->Value {
+        {"io.flush", [](ArgSpan args, void*)->Value {
             std::lock_guard<std::mutex> lk(io_mtx);
             std::cout.flush();
             std::cerr.flush();
             std::fflush(nullptr);
             return Value::make_nil();
-        });
+        }},
 
-        host.register_function("io.set_auto_flush", [](const std::vector<Value> &args)->Value {
+        {"io.set_auto_flush", [](ArgSpan args, void*)->Value {
             bool on = false;
-            if (!args.empty() && args[0].tag == Tag::Number) on = (args[0].num != 0.0);
+            if (!args.empty() && args[0].tag() == Tag::Number) on = (args[0].num() != 0.0);
             if (on) {
                 std::cout.setf(std::ios::unitbuf);
                 std::cerr.setf(std::ios::unitbuf);
@@ -178,11 +214,11 @@ namespace mondot_host
                 std::cerr.unsetf(std::ios::unitbuf);
             }
             return Value::make_nil();
-        });
+        }},
 
-        host.register_function("io.flush_and_exit", [](const std::vector<Value> &args)->Value {
+        {"io.flush_and_exit", [](ArgSpan args, void*)->Value {
             int code = 0;
-            if (!args.empty() && args[0].tag == Tag::Number) code = static_cast<int>(args[0].num);
+            if (!args.empty() && args[0].tag() == Tag::Number) code = static_cast<int>(args[0].num());
             {
                 std::lock_guard<std::mutex> lk(io_mtx);
                 std::cout.flush();
@@ -191,65 +227,61 @@ namespace mondot_host
             }
             std::exit(code);
             return Value::make_nil();
-        });
+        }},
 
         // Strings & introspection
-        host.register_function("strlen", [](const std::vector<Value> &args)->Value {
-            if (!args.empty() && args[0].tag == Tag::String)
-                return Value::make_number(static_cast<double>(args[0].s->size()));
+        pure(returns({"strlen", [](ArgSpan args, void*)->Value {
+            if (!args.empty() && args[0].tag() == Tag::String)
+                return Value::make_number(static_cast<double>(args[0].str().size()));
             return Value::make_number(0.0);
-        });
+        }}, HostType::Number)),
 
-        host.register_function("len", [](const std::vector<Value> &args)->Value {
+        pure(returns({"len", [](ArgSpan args, void*)->Value {
             if (args.empty()) return Value::make_number(0.0);
             const Value &v = args[0];
-            switch (v.tag) {
-                case Tag::String: return Value::make_number(static_cast<double>(v.s->size()));
+            switch (v.tag()) {
+                case Tag::String: return Value::make_number(static_cast<double>(v.str().size()));
                 // If you have arrays/objects, add cases here.
                 default: return Value::make_number(0.0);
             }
-        });
-
-        host.register_function("str_char_at", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::String && args[1].tag == Tag::Number) {
-                int idx = static_cast<int>(args[1].num);
-                const std::string &s = *args[0].s;
-                if (idx >= 0 && idx < static_cast<int>(s.size())) {
-                    std::string r;
-                    r.reserve(1);
-                    r.push_back(s[idx]);
-                    return Value::make_string(std::move(r));
-                }
+        }}, HostType::Number)),
+
+        pure({"str_char_at", [](ArgSpan args, void*)->Value {
+            if (args.size() >= 2 && args[0].tag() == Tag::String && args[1].tag() == Tag::Number) {
+                int idx = static_cast<int>(args[1].num());
+                const std::string &s = args[0].str();
+                if (idx >= 0 && idx < static_cast<int>(s.size()))
+                    return char_string(static_cast<unsigned char>(s[idx]));
             }
             return Value::make_string(std::string());
-        });
+        }}),
 
-        host.register_function("tostring", [](const std::vector<Value> &args)->Value {
+        pure({"tostring", [](ArgSpan args, void*)->Value {
             if (args.empty()) return Value::make_string(std::string("nil"));
             return Value::make_string(fast_to_string(args[0]));
-        });
+        }}, HostCost::Moderate),
 
-        host.register_function("typeof", [](const std::vector<Value> &args)->Value {
+        pure({"typeof", [](ArgSpan args, void*)->Value {
             if (args.empty()) return Value::make_string(std::string("nil"));
-            switch (args[0].tag) {
+            switch (args[0].tag()) {
                 case Tag::Number:  return Value::make_string(std::string("number"));
                 case Tag::String:  return Value::make_string(std::string("string"));
                 case Tag::Boolean: return Value::make_string(std::string("boolean"));
                 case Tag::Nil:     return Value::make_string(std::string("nil"));
                 default:           return Value::make_string(std::string("object"));
             }
-        });
+        }}),
 
         // Arithmetic & string concat
-        host.register_function("add", [](const std::vector<Value> &args)->Value {
+        pure({"add", [](ArgSpan args, void*)->Value {
             if (args.size() >= 2) {
                 const Value &a = args[0];
                 const Value &b = args[1];
-                if (a.tag == Tag::Number && b.tag == Tag::Number)
-                    return Value::make_number(a.num + b.num);
-                if (a.tag == Tag::String && b.tag == Tag::String) {
-                    const std::string &sa = *a.s;
-                    const std::string &sb = *b.s;
+                if (a.tag() == Tag::Number && b.tag() == Tag::Number)
+                    return Value::make_number(a.num() + b.num());
+                if (a.tag() == Tag::String && b.tag() == Tag::String) {
+                    const std::string &sa = a.str();
+                    const std::string &sb = b.str();
                     std::string out;
                     out.reserve(sa.size() + sb.size());
                     out.append(sa);
@@ -261,95 +293,35 @@ namespace mondot_host
                 return Value::make_string(std::move(out));
             }
             return Value::make_number(0.0);
-        });
-
-        host.register_function("sub", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::Number && args[1].tag == Tag::Number)
-                return Value::make_number(args[0].num - args[1].num);
-            return Value::make_number(0.0);
-        });
-
-        host.register_function("mul", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::Number && args[1].tag == Tag::Number)
-                return Value::make_number(args[0].num * args[1].num);
-            return Value::make_number(0.0);
-        });
-
-        host.register_function("div", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::Number && args[1].tag == Tag::Number) {
-                double d = args[1].num;
-                if (d != 0.0) return Value::make_number(args[0].num / d);
-            }
-            return Value::make_number(0.0);
-        });
-
-        host.register_function("lt", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::Number && args[1].tag == Tag::Number)
-                return Value::make_number(args[0].num < args[1].num ? 1.0 : 0.0);
-            return Value::make_number(0.0);
-        });
+        }}, HostCost::Moderate),
 
-        host.register_function("gt", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::Number && args[1].tag == Tag::Number)
-                return Value::make_number(args[0].num > args[1].num ? 1.0 : 0.0);
-            return Value::make_number(0.0);
-        });
+        pure(bind<m_sub>("sub")),
+        pure(bind<m_mul>("mul")),
+        pure(bind<m_div>("div")),
+        pure(bind<m_lt>("lt")),
+        pure(bind<m_gt>("gt")),
 
-        host.register_function("eq", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2) {
-                const Value &a = args[0], &b = args[1];
-                if (a.tag != b.tag) return Value::make_number(0.0);
-                switch (a.tag) {
-                    case Tag::Number: return Value::make_number(a.num == b.num ? 1.0 : 0.0);
-                    case Tag::String: return Value::make_number((*a.s == *b.s) ? 1.0 : 0.0);
-                    case Tag::Boolean: return Value::make_number(a.boolean == b.boolean ? 1.0 : 0.0);
-                    case Tag::Nil: return Value::make_number(1.0);
-                    default: return Value::make_number(0.0);
-                }
-            }
-            return Value::make_number(0.0);
-        });
+        pure(returns({"eq", [](ArgSpan args, void*)->Value {
+            if (args.size() < 2) return Value::make_number(0.0);
+            return Value::make_number(values_equal(args[0], args[1]) ? 1.0 : 0.0);
+        }}, HostType::Number)),
 
-        host.register_function("neq", [](const std::vector<Value> &args)->Value {
+        pure(returns({"neq", [](ArgSpan args, void*)->Value {
             if (args.size() < 2) return Value::make_number(0.0);
-            const Value &a = args[0];
-            const Value &b = args[1];
-            if (a.tag != b.tag) return Value::make_number(1.0);
-            switch (a.tag) {
-                case Tag::Number: return Value::make_number(a.num != b.num ? 1.0 : 0.0);
-                case Tag::String: return Value::make_number((*a.s != *b.s) ? 1.0 : 0.0);
-                case Tag::Boolean: return Value::make_number(a.boolean != b.boolean ? 1.0 : 0.0);
-                case Tag::Nil: return Value::make_number(0.0);
-                default: return Value::make_number(1.0);
-            }
-        });
+            return Value::make_number(values_equal(args[0], args[1]) ? 0.0 : 1.0);
+        }}, HostType::Number)),
 
         // bitwise helpers (treat numbers as int64)
-        host.register_function("shift", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::Number && args[1].tag == Tag::Number) {
-                int64_t a = static_cast<int64_t>(args[0].num);
-                int64_t b = static_cast<int64_t>(args[1].num);
-                if (b >= 0 && b < 63) return Value::make_number(static_cast<double>(a << b));
-            }
-            return Value::make_number(0.0);
-        });
-
-        host.register_function("bitwise", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::Number && args[1].tag == Tag::Number) {
-                int64_t a = static_cast<int64_t>(args[0].num);
-                int64_t b = static_cast<int64_t>(args[1].num);
-                if (b >= 0 && b < 63) return Value::make_number(static_cast<double>(a >> b));
-            }
-            return Value::make_number(0.0);
-        });
+        pure(bind<m_shift>("shift")),
+        pure(bind<m_bitwise>("bitwise")),
 
         // conversions / parsing
-        host.register_function("tonumber", [](const std::vector<Value> &args)->Value {
+        pure(returns({"tonumber", [](ArgSpan args, void*)->Value {
             if (args.empty()) return Value::make_number(0.0);
             const Value &v = args[0];
-            if (v.tag == Tag::Number) return Value::make_number(v.num);
-            if (v.tag == Tag::String) {
-                const std::string &s = *v.s;
+            if (v.tag() == Tag::Number) return Value::make_number(v.num());
+            if (v.tag() == Tag::String) {
+                const std::string &s = v.str();
                 // try std::from_chars
                 double out = 0.0;
                 // from_chars for double isn't fully supported portably -> use std::strtod fallback
@@ -360,134 +332,93 @@ namespace mondot_host
                 if (end != cstr && errno == 0) return Value::make_number(val);
             }
             return Value::make_number(0.0);
-        });
+        }}, HostType::Number)),
 
-        host.register_function("toint", [](const std::vector<Value> &args)->Value {
+        pure(returns({"toint", [](ArgSpan args, void*)->Value {
             if (args.empty()) return Value::make_number(0.0);
             const Value &v = args[0];
-            if (v.tag == Tag::Number) return Value::make_number(std::floor(v.num));
-            if (v.tag == Tag::String) {
-                const std::string &s = *v.s;
+            if (v.tag() == Tag::Number) return Value::make_number(std::floor(v.num()));
+            if (v.tag() == Tag::String) {
+                const std::string &s = v.str();
                 char *end = nullptr;
                 long val = std::strtol(s.c_str(), &end, 10);
                 if (end != s.c_str()) return Value::make_number(static_cast<double>(val));
             }
             return Value::make_number(0.0);
-        });
+        }}, HostType::Number)),
 
         // simple math helpers
-        host.register_function("floor", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag == Tag::Number) return Value::make_number(std::floor(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("ceil", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag == Tag::Number) return Value::make_number(std::ceil(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("abs", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag == Tag::Number) return Value::make_number(std::fabs(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("min", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag==Tag::Number && args[1].tag==Tag::Number)
-                return Value::make_number(std::min(args[0].num, args[1].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("max", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag==Tag::Number && args[1].tag==Tag::Number)
-                return Value::make_number(std::max(args[0].num, args[1].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("pow", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag==Tag::Number && args[1].tag==Tag::Number)
-                return Value::make_number(std::pow(args[0].num, args[1].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("sqrt", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag==Tag::Number)
-                return Value::make_number(std::sqrt(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("sin", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag==Tag::Number) return Value::make_number(std::sin(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("cos", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag==Tag::Number) return Value::make_number(std::cos(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("tan", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag==Tag::Number) return Value::make_number(std::tan(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("log", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag==Tag::Number) return Value::make_number(std::log(args[0].num));
-            return Value::make_number(0.0);
-        });
-        host.register_function("exp", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag==Tag::Number) return Value::make_number(std::exp(args[0].num));
-            return Value::make_number(0.0);
-        });
-    }
-
-    void register_extra_host_functions(HostBridge &host)
-    {
-        host.register_function("io.input", [](const std::vector<Value> &args)->Value {
+        pure(bind<m_floor>("floor")),
+        pure(bind<m_ceil>("ceil")),
+        pure(bind<m_abs>("abs")),
+        pure(bind<m_min>("min")),
+        pure(bind<m_max>("max")),
+        pure(bind<m_pow>("pow")),
+        pure(bind<m_sqrt>("sqrt")),
+        pure(bind<m_sin>("sin")),
+        pure(bind<m_cos>("cos")),
+        pure(bind<m_tan>("tan")),
+        pure(bind<m_log>("log")),
+        pure(bind<m_exp>("exp")),
+    };
+
+    static constexpr HostBinding EXTRA_BINDINGS[] = {
+        {"io.input", [](ArgSpan args, void*)->Value {
             std::string line;
             if (!std::getline(std::cin, line)) return Value::make_string(std::string());
             return Value::make_string(std::move(line));
-        });
+        }},
 
-        host.register_function("sleep_ms", [](const std::vector<Value> &args)->Value {
-            if (!args.empty() && args[0].tag == Tag::Number) {
-                int ms = static_cast<int>(args[0].num);
+        {"sleep_ms", [](ArgSpan args, void*)->Value {
+            if (!args.empty() && args[0].tag() == Tag::Number) {
+                int ms = static_cast<int>(args[0].num());
                 if (ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
             }
             return Value::make_nil();
-        });
+        }},
 
-        host.register_function("time_ms", [](const std::vector<Value> &args)->Value {
+        {"time_ms", [](ArgSpan args, void*)->Value {
             using namespace std::chrono;
             auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
             return Value::make_number(static_cast<double>(now));
-        });
+        }},
 
         // random: thread_local rng
-        host.register_function("rand", [](const std::vector<Value> &args)->Value {
+        {"rand", [](ArgSpan args, void*)->Value {
             thread_local std::mt19937_64 rng_local((unsigned)std::chrono::high_resolution_clock::now().time_since_epoch().count());
             std::uniform_real_distribution<double> dist(0.0, 1.0);
             return Value::make_number(dist(rng_local));
-        });
+        }},
 
-        host.register_function("substr", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::String && args[1].tag == Tag::Number) {
-                const std::string &s = *args[0].s;
-                int start = static_cast<int>(args[1].num);
+        pure({"substr", [](ArgSpan args, void*)->Value {
+            if (args.size() >= 2 && args[0].tag() == Tag::String && args[1].tag() == Tag::Number) {
+                const std::string &s = args[0].str();
+                int start = static_cast<int>(args[1].num());
                 if (start < 0) start = 0;
                 if (start >= (int)s.size()) return Value::make_string(std::string());
                 size_t len = s.size() - start;
-                if (args.size() >= 3 && args[2].tag == Tag::Number) {
-                    int l = static_cast<int>(args[2].num);
+                if (args.size() >= 3 && args[2].tag() == Tag::Number) {
+                    int l = static_cast<int>(args[2].num());
                     if (l >= 0) len = static_cast<size_t>(std::min<int>(l, static_cast<int>(len)));
                 }
                 return Value::make_string(s.substr(static_cast<size_t>(start), len));
             }
             return Value::make_string(std::string());
-        });
+        }}, HostCost::Moderate),
 
-        host.register_function("index_of", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::String && args[1].tag == Tag::String) {
-                const std::string &s = *args[0].s, &sub = *args[1].s;
+        pure(returns({"index_of", [](ArgSpan args, void*)->Value {
+            if (args.size() >= 2 && args[0].tag() == Tag::String && args[1].tag() == Tag::String) {
+                const std::string &s = args[0].str(), &sub = args[1].str();
                 size_t pos = s.find(sub);
                 if (pos == std::string::npos) return Value::make_number(-1.0);
                 return Value::make_number(static_cast<double>(pos));
             }
             return Value::make_number(-1.0);
-        });
+        }}, HostType::Number), HostCost::Moderate),
 
-        host.register_function("read_file", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 1 && args[0].tag == Tag::String) {
-                const std::string &path = *args[0].s;
+        {"read_file", [](ArgSpan args, void*)->Value {
+            if (args.size() >= 1 && args[0].tag() == Tag::String) {
+                const std::string &path = args[0].str();
                 std::ifstream ifs(path, std::ios::binary);
                 if (!ifs) return Value::make_string(std::string());
                 std::string out;
@@ -501,12 +432,12 @@ namespace mondot_host
                 return Value::make_string(std::move(out));
             }
             return Value::make_string(std::string());
-        });
+        }},
 
-        host.register_function("write_file", [](const std::vector<Value> &args)->Value {
-            if (args.size() >= 2 && args[0].tag == Tag::String && args[1].tag == Tag::String) {
-                const std::string &path = *args[0].s;
-                const std::string &content = *args[1].s;
+        {"write_file", [](ArgSpan args, void*)->Value {
+            if (args.size() >= 2 && args[0].tag() == Tag::String && args[1].tag() == Tag::String) {
+                const std::string &path = args[0].str();
+                const std::string &content = args[1].str();
                 std::ofstream ofs(path, std::ios::binary);
                 if (!ofs) return Value::make_number(0.0);
                 ofs.write(content.data(), static_cast<std::streamsize>(content.size()));
@@ -514,6 +445,16 @@ namespace mondot_host
                 return Value::make_number(1.0);
             }
             return Value::make_number(0.0);
-        });
+        }},
+    };
+
+    void register_core_host_functions(HostBridge &host)
+    {
+        host.register_table(CORE_BINDINGS);
+    }
+
+    void register_extra_host_functions(HostBridge &host)
+    {
+        host.register_table(EXTRA_BINDINGS);
     }
 }
@@ -1,20 +1,70 @@
 #ifndef MONDOT_HOST_MANIFEST_H
 #define MONDOT_HOST_MANIFEST_H
 
-#include <unordered_set>
+#include <unordered_map>
 #include <string>
 #include <mutex>
 #include <shared_mutex>
+#include <cstdint>
+#include <cstddef>
+
+struct HostSlot;
+
+// Static type of a host parameter or result, as far as the binding knows.
+enum class HostType : uint8_t { Any, Number };
+
+// Rough cost of one call. Pure calls up to Moderate are run by the
+// compiler when their arguments are constants; Expensive ones are left to
+// run time, where they can be memoized instead. Only Cheap ones are
+// hoisted out of a loop that might not make them at all (see ssa.h).
+enum class HostCost : uint8_t { Cheap, Moderate, Expensive };
+
+// What a typed binding promises about a host function. Untyped
+// registrations publish the default (variadic, Any -> Any, impure,
+// Moderate).
+struct HostSignature
+{
+    static constexpr size_t MAX_PARAMS = 4;
+
+    HostType result = HostType::Any;
+    int8_t argc = -1;                       // -1: variadic / unchecked
+    HostType params[MAX_PARAMS] = {};
+    // no side effects and the result depends on the args alone, so the
+    // compiler may share one call between equal call sites and hoist it
+    // out of loops (see ssa.h)
+    bool pure = false;
+    HostCost cost = HostCost::Moderate;
+    // pure and worth remembering: the bridge caches results per argument
+    // values (see HostMemo in host.h)
+    bool memoize = false;
+
+    // every parameter and the result are Number, so call sites whose
+    // arguments are statically numbers can go through the unboxed entry
+    bool all_numeric() const
+    {
+        if(argc < 0 || result != HostType::Number) return false;
+        for(int i = 0; i < argc; ++i)
+            if(params[i] != HostType::Number) return false;
+        return true;
+    }
+};
 
 struct HostManifest
 {
-    static inline std::unordered_set<std::string> names;
+    struct Entry
+    {
+        HostSignature sig;
+        const HostSlot *slot = nullptr;     // the registration, see fold_slot
+    };
+
+    static inline std::unordered_map<std::string, Entry> names;
     static inline std::shared_mutex names_mtx;
 
-    static void register_name(const std::string &n)
+    static void register_name(const std::string &n, const HostSignature &sig = HostSignature(),
+                              const HostSlot *slot = nullptr)
     {
         std::unique_lock<std::shared_mutex> lock(names_mtx);
-        names.insert(n);
+        names[n] = Entry{sig, slot};
     }
 
     static void unregister_name(const std::string &n)
@@ -28,6 +78,26 @@ struct HostManifest
         std::shared_lock<std::shared_mutex> lock(names_mtx);
         return names.find(n) != names.end();
     }
+
+    static bool signature(const std::string &n, HostSignature &out)
+    {
+        std::shared_lock<std::shared_mutex> lock(names_mtx);
+        auto it = names.find(n);
+        if(it == names.end()) return false;
+        out = it->second.sig;
+        return true;
+    }
+
+    // the registration the compiler may call to fold n over constant
+    // arguments: pure and not Expensive, or null
+    static const HostSlot *fold_slot(const std::string &n)
+    {
+        std::shared_lock<std::shared_mutex> lock(names_mtx);
+        auto it = names.find(n);
+        if(it == names.end() || !it->second.sig.pure || it->second.sig.cost == HostCost::Expensive)
+            return nullptr;
+        return it->second.slot;
+    }
 };
 
 #endif
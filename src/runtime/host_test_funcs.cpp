@@ -0,0 +1,87 @@
+#include "host_test_funcs.h"
+#include "host_bind.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace mondot_host
+{
+    // the n-th prime (nth_prime(1) == 2) by trial division; memoized, the
+    // cost grows with n. Out of range: 0
+    static double m_nth_prime(double x)
+    {
+        if (!(x >= 1.0 && x <= 1000000.0)) return 0.0;
+        int64_t n = static_cast<int64_t>(x), found = 0, p = 1;
+        while (found < n)
+        {
+            ++p;
+            bool prime = true;
+            for (int64_t d = 2; d * d <= p && prime; ++d) prime = p % d != 0;
+            if (prime) ++found;
+        }
+        return static_cast<double>(p);
+    }
+
+    // Levenshtein distance between the string forms of a and b; memoized,
+    // it takes time proportional to the product of their lengths
+    static Value h_edit_distance(ArgSpan args, void*)
+    {
+        if (args.size() < 2) return Value::make_number(0.0);
+        std::string a = value_to_string(args[0]), b = value_to_string(args[1]);
+        std::vector<size_t> row(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); ++j) row[j] = j;
+        for (size_t i = 1; i <= a.size(); ++i)
+        {
+            size_t diag = row[0];
+            row[0] = i;
+            for (size_t j = 1; j <= b.size(); ++j)
+            {
+                size_t up = row[j];
+                row[j] = std::min({row[j] + 1, row[j - 1] + 1, diag + (a[i - 1] != b[j - 1])});
+                diag = up;
+            }
+        }
+        return Value::make_number(static_cast<double>(row[b.size()]));
+    }
+
+    // rule(type): a new Rule handle from the bridge
+    static Value h_rule(ArgSpan args, void *data)
+    {
+        HostBridge &host = *static_cast<HostBridge*>(data);
+        std::string type = !args.empty() && args[0].is_string() ? args[0].str() : std::string();
+        return Value::make_rule(host.create_rule(type));
+    }
+
+    // memo_stats(name, field): 'hits', 'misses', 'bypassed', 'evictions' or
+    // 'size' of a memoized function's cache; nil when name is not memoized
+    static Value h_memo_stats(ArgSpan args, void *data)
+    {
+        const HostBridge &host = *static_cast<const HostBridge*>(data);
+        HostMemoStats st;
+        if (args.size() < 2 || !args[0].is_string() || !args[1].is_string() ||
+            !host.memo_stats(args[0].str(), st))
+            return Value::make_nil();
+        const std::string &field = args[1].str();
+        size_t n = field == "hits" ? st.hits : field == "misses" ? st.misses : field == "bypassed" ? st.bypassed :
+                   field == "evictions" ? st.evictions : field == "size" ? st.size : 0;
+        return Value::make_number(static_cast<double>(n));
+    }
+
+    using mondot_bind::bind;
+    using mondot_bind::returns;
+    using mondot_bind::memoized;
+
+    static constexpr HostBinding TEST_BINDINGS[] = {
+        memoized(returns({"edit_distance", h_edit_distance}, HostType::Number)),
+        // numeric, so a typed call site exercises the dropped unboxed entry
+        memoized(bind<m_nth_prime>("nth_prime")),
+    };
+
+    void register_test_host_functions(HostBridge &host)
+    {
+        host.register_table(TEST_BINDINGS);
+        // these need the bridge itself
+        host.register_native("rule", h_rule, &host);
+        host.register_native("memo_stats", h_memo_stats, &host);
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "host.h"
+
+namespace mondot_host
+{
+    // Fixtures the demo tests check the runtime with: memoized functions
+    // and their cache counts, and Rule handles. RunController registers
+    // them for --test, --jit-diff and the modes that only compile, never
+    // where scripts run for real.
+    void register_test_host_functions(HostBridge &host);
+}
@@ -0,0 +1,805 @@
+#include "jit.h"
+#include "util.h"
+
+#if MONDOT_JIT_ENABLED
+
+#include "vm_ops.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Executes one instruction generically on behalf of jitted code, with the
+// same semantics as the interpreter's handler; the templates call it for
+// whatever their inline fast path does not cover (see Translator::emit). Returns 1 when a branching
+// instruction takes its jump, 0 to fall through, -1 after an exception
+// (stashed in jf->error; the code then leaves the function).
+static int jit_slow(JitFrame *jf, const Op *pc)
+{
+    Value *&sp = jf->sp;
+    Value *locals = jf->locals;
+    const Value *consts = jf->func->const_data;
+    try
+    {
+        OpCode op = generic_opcode(pc->op);
+        switch(op)
+        {
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+                sp[-2] = arith_slow(op, sp[-2], sp[-1]);
+                *--sp = Value();
+                return 0;
+            case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+                sp[-2] = Value::make_boolean(
+                    test_local_const((OpCode)(OP_TEST_LT_LK + (op - OP_LT)), sp[-2], sp[-1]));
+                *--sp = Value();
+                return 0;
+            case OP_NOT:
+                sp[-1] = Value::make_boolean(!is_truthy(sp[-1]));
+                return 0;
+            case OP_NEG:
+                sp[-1] = Value::make_number(sp[-1].is_number() ? -sp[-1].num() : 0.0);
+                return 0;
+            case OP_CALL_HOST:
+            case OP_CALL_HOST_NUM:
+            case OP_CALL_HOST_POP:
+            {
+                int nargs = pc->a;
+                *jf->top = sp;
+                HostSlot *slot = jf->host->site_slot(jf->func->host_calls[pc->b]);
+                ArgSpan args{sp - nargs, (size_t)nargs};
+                Value r;
+                if(!slot) r = Value::make_nil();
+                else if(op == OP_CALL_HOST_NUM && slot->unboxed && slot->sig.argc == nargs &&
+                        (!pc->c || all_numbers(args)))
+                    r = Value::make_number(slot->unboxed(args.data));
+                else r = slot->call(args);
+                for(int n = 0; n < nargs; ++n) *--sp = Value();
+                if(op != OP_CALL_HOST_POP) *sp++ = move(r);
+                return 0;
+            }
+            case OP_INC_LOCAL:
+                locals[pc->a] = arith_slow(OP_ADD, locals[pc->a], consts[pc->b]);
+                return 0;
+            case OP_TEST_LT_LK: case OP_TEST_LE_LK: case OP_TEST_GT_LK:
+            case OP_TEST_GE_LK: case OP_TEST_EQ_LK: case OP_TEST_NE_LK:
+                return test_local_const(op, locals[pc->b], consts[pc->c]) ? 0 : 1;
+            default:
+                return 0;
+        }
+    }
+    catch(...)
+    {
+        jf->error = current_exception();
+        return -1;
+    }
+}
+
+// a string whose last reference jitted code just dropped (its count is
+// already zero): hands it back to Value's normal release path
+static void jit_string_released(StringObject *o)
+{
+    o->refs.store(1, memory_order_relaxed);
+    Value dead = Value::adopt_string(o);
+}
+
+namespace
+{
+    enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+    enum Xmm { XMM0, XMM1, XMM2 };
+    enum Cond { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+                CC_S = 0x8, CC_P = 0xa, CC_NP = 0xb };
+
+    // Register use of the generated code. rbx, r12, r13 and r15 are
+    // callee-saved, so they survive the helper calls.
+    constexpr int JF = RBX;         // JitFrame*
+    constexpr int SP = R12;         // operand stack pointer (Value*)
+    constexpr int LOCALS = R13;     // first local (Value*)
+    constexpr int QNAN = R15;       // Value::QNAN, which is also NIL_BITS
+
+    constexpr int32_t JF_SP = (int32_t)offsetof(JitFrame, sp);
+    constexpr int32_t JF_ENTRY = (int32_t)offsetof(JitFrame, entry_ip);
+    constexpr int32_t JF_RET = (int32_t)offsetof(JitFrame, ret);
+
+    // just the x86-64 encodings the templates need
+    struct Assembler
+    {
+        vector<uint8_t> buf;
+        vector<int> labels;                     // bound offset, -1 until bound
+        vector<pair<size_t,int>> fixups;        // rel32 field, label
+
+        int new_label() { labels.push_back(-1); return (int)labels.size() - 1; }
+        void bind(int l) { labels[l] = (int)buf.size(); }
+
+        void byte(uint8_t b) { buf.push_back(b); }
+        void u32(uint32_t v) { for(int i = 0; i < 4; ++i) byte((uint8_t)(v >> (8 * i))); }
+        void u64(uint64_t v) { for(int i = 0; i < 8; ++i) byte((uint8_t)(v >> (8 * i))); }
+
+        void rex(bool w, int reg, int rm)
+        {
+            uint8_t r = (uint8_t)(0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0));
+            if(r != 0x40) byte(r);
+        }
+        void modrm_reg(int reg, int rm) { byte((uint8_t)(0xc0 | ((reg & 7) << 3) | (rm & 7))); }
+        void modrm_mem(int reg, int base, int32_t disp)
+        {
+            bool small = disp >= -128 && disp <= 127;
+            byte((uint8_t)((small ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7)));
+            if((base & 7) == RSP) byte(0x24);      // rsp / r12 base needs a SIB
+            if(small) byte((uint8_t)disp);
+            else u32((uint32_t)disp);
+        }
+
+        void load(int dst, int base, int32_t disp) { rex(true, dst, base); byte(0x8b); modrm_mem(dst, base, disp); }
+        void load32(int dst, int base, int32_t disp) { rex(false, dst, base); byte(0x8b); modrm_mem(dst, base, disp); }
+        void store(int base, int32_t disp, int src) { rex(true, src, base); byte(0x89); modrm_mem(src, base, disp); }
+        void mov(int dst, int src) { rex(true, src, dst); byte(0x89); modrm_reg(src, dst); }
+        void mov_imm(int dst, uint64_t imm) { rex(true, 0, dst); byte((uint8_t)(0xb8 + (dst & 7))); u64(imm); }
+        // 0x01 add, 0x21 and, 0x31 xor, 0x39 cmp (dst op src)
+        void alu(uint8_t opc, int dst, int src) { rex(true, src, dst); byte(opc); modrm_reg(src, dst); }
+        // /0 add, /5 sub
+        void alu_imm(int ext, int dst, int32_t imm) { rex(true, 0, dst); byte(0x81); modrm_reg(ext, dst); u32((uint32_t)imm); }
+        void cmp32_imm(int r, uint32_t imm) { rex(false, 0, r); byte(0x81); modrm_reg(7, r); u32(imm); }
+        void shr(int r, uint8_t n) { rex(true, 0, r); byte(0xc1); modrm_reg(5, r); byte(n); }
+        void test32(int r) { rex(false, r, r); byte(0x85); modrm_reg(r, r); }
+
+        void movq_to_xmm(int x, int r) { byte(0x66); rex(true, x, r); byte(0x0f); byte(0x6e); modrm_reg(x, r); }
+        void movq_from_xmm(int r, int x) { byte(0x66); rex(true, x, r); byte(0x0f); byte(0x7e); modrm_reg(x, r); }
+        // scalar double ops on xmm0..xmm2: 0x58 add, 0x59 mul, 0x5c sub, 0x5e div
+        void sd(uint8_t opc, int dst, int src) { byte(0xf2); byte(0x0f); byte(opc); modrm_reg(dst, src); }
+        void ucomisd(int a, int b) { byte(0x66); byte(0x0f); byte(0x2e); modrm_reg(a, b); }
+        void xorpd(int dst, int src) { byte(0x66); byte(0x0f); byte(0x57); modrm_reg(dst, src); }
+
+        // lock inc / lock dec dword [base]; dec leaves ZF set at zero
+        void lock_inc32(int base) { byte(0xf0); rex(false, 0, base); byte(0xff); modrm_mem(0, base, 0); }
+        void lock_dec32(int base) { byte(0xf0); rex(false, 0, base); byte(0xff); modrm_mem(1, base, 0); }
+        // cmp byte [base + disp], 0
+        void cmp8_zero(int base, int32_t disp) { rex(false, 0, base); byte(0x80); modrm_mem(7, base, disp); byte(0); }
+
+        // al / cl only
+        void setcc(int cc, int r8) { byte(0x0f); byte((uint8_t)(0x90 + cc)); modrm_reg(0, r8); }
+
+        void jcc(int cc, int label) { byte(0x0f); byte((uint8_t)(0x80 + cc)); fixup(label); }
+        void jmp(int label) { byte(0xe9); fixup(label); }
+        void fixup(int label) { fixups.push_back({buf.size(), label}); u32(0); }
+        void call(const void *fn) { mov_imm(RAX, (uint64_t)(uintptr_t)fn); byte(0xff); byte(0xd0); }
+        void push(int r) { rex(false, 0, r); byte((uint8_t)(0x50 + (r & 7))); }
+        void pop(int r) { rex(false, 0, r); byte((uint8_t)(0x58 + (r & 7))); }
+        void ret() { byte(0xc3); }
+
+        bool resolve()
+        {
+            for(auto &fx : fixups)
+            {
+                int to = labels[fx.second];
+                if(to < 0) return false;
+                int32_t rel = to - (int32_t)(fx.first + 4);
+                memcpy(&buf[fx.first], &rel, sizeof(rel));
+            }
+            return true;
+        }
+    };
+
+    inline int32_t slot(int i) { return i * (int32_t)sizeof(Value); }
+
+    class Translator
+    {
+    public:
+        explicit Translator(ByteFunc &fn): f(fn), code(fn.code) {}
+
+        bool run()
+        {
+            if(code.empty() || !analyze()) return false;
+
+            size_t n = code.size();
+            for(size_t i = 0; i <= n; ++i) ip_label.push_back(as.new_label());
+            l_ret = as.new_label();
+            l_exit = as.new_label();
+
+            prologue();
+            for(size_t ip = 0; ip < n; ++ip)
+            {
+                as.bind(ip_label[ip]);
+                if(depth[ip] >= 0) emit(ip);
+            }
+            as.bind(ip_label[n]);
+            for(const Stub &s : stubs)
+            {
+                as.bind(s.entry);
+                if(s.op) helper_call(s.op, s.resume, s.target);
+                else
+                {
+                    as.mov(RDI, RDX);
+                    as.call((const void *)&jit_string_released);
+                    as.jmp(s.resume);
+                }
+            }
+            epilogue();
+            return as.resolve();
+        }
+
+        const vector<uint8_t> &bytes() const { return as.buf; }
+
+    private:
+        // out-of-line slow path: jit_slow for op, or (op null) the final
+        // release of the string in rdx
+        struct Stub { int entry; const Op *op; int resume; int target; };
+
+        ByteFunc &f;
+        const vector<Op> &code;
+        Assembler as;
+        vector<int> depth;          // operand stack depth at each ip, -1 if unreachable
+        vector<bool> target;        // some jump lands here
+        vector<bool> entry;         // the VM may enter here (0 and loop headers)
+        vector<int> ip_label;
+        vector<Stub> stubs;
+        int l_ret = -1, l_exit = -1;
+
+        const Value &konst(int i) const { return f.const_data[i]; }
+
+        // Stack depth at every reachable ip, and the operand checks the
+        // interpreter would otherwise make at run time. Anything the
+        // templates do not handle rejects the whole function.
+        bool analyze()
+        {
+            size_t n = code.size();
+            size_t nlocals = f.locals.size(), nconsts = f.consts ? f.consts->size() : 0;
+            auto local_ok = [&](int i) { return i >= 0 && (size_t)i < nlocals; };
+            auto const_ok = [&](int i) { return i >= 0 && (size_t)i < nconsts; };
+
+            depth.assign(n, -1);
+            target.assign(n + 1, false);
+            entry.assign(n, false);
+            entry[0] = true;
+            vector<size_t> work{0};
+            depth[0] = 0;
+            while(!work.empty())
+            {
+                size_t ip = work.back();
+                work.pop_back();
+                const Op &op = code[ip];
+                OpCode g = generic_opcode(op.op);
+                int in = 0;
+                bool ok = true;
+                switch(g)
+                {
+                    case OP_NOP: case OP_JMP: case OP_RET: break;
+                    case OP_PUSH_CONST: case OP_RET_CONST: ok = const_ok(op.a); break;
+                    case OP_PUSH_LOCAL: case OP_PUSH_LOCAL_MOVE: ok = local_ok(op.a); break;
+                    case OP_STORE_LOCAL: ok = local_ok(op.a); in = 1; break;
+                    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+                    case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+                        in = 2; break;
+                    case OP_NOT: case OP_NEG: case OP_JMP_IF_FALSE: case OP_JMP_IF_TRUE: in = 1; break;
+                    case OP_POP: ok = op.a >= 0; in = op.a; break;
+                    case OP_CALL_HOST: case OP_CALL_HOST_NUM: case OP_CALL_HOST_POP:
+                        ok = op.a >= 0 && op.b < f.host_calls.size(); in = op.a; break;
+                    case OP_PUSH_LOCAL2: case OP_MOVE_LOCAL: ok = local_ok(op.a) && local_ok(op.b); break;
+                    case OP_STORE_CONST: case OP_INC_LOCAL: ok = local_ok(op.a) && const_ok(op.b); break;
+                    case OP_TEST_LT_LK: case OP_TEST_LE_LK: case OP_TEST_GT_LK:
+                    case OP_TEST_GE_LK: case OP_TEST_EQ_LK: case OP_TEST_NE_LK:
+                        ok = local_ok(op.b) && const_ok(op.c); break;
+                    default:
+                        return false;       // script calls stay in the interpreter
+                }
+                int d = depth[ip];
+                int next = d + stack_effect(op);
+                if(!ok || d < in || next > (int)f.max_stack) return false;
+
+                auto flow = [&](size_t to)
+                {
+                    if(to >= n) return false;
+                    if(depth[to] < 0)
+                    {
+                        depth[to] = next;
+                        work.push_back(to);
+                        return true;
+                    }
+                    return depth[to] == next;
+                };
+                if(is_jump_op(op.op))
+                {
+                    if(op.a < 0 || !flow((size_t)op.a)) return false;
+                    target[op.a] = true;
+                    if(g == OP_JMP && (size_t)op.a <= ip) entry[op.a] = true;
+                }
+                if(g != OP_JMP && g != OP_RET && g != OP_RET_CONST && !flow(ip + 1)) return false;
+            }
+            return true;
+        }
+
+        void prologue()
+        {
+            // five pushes leave rsp 16-byte aligned for the helper calls
+            as.push(RBX); as.push(RBP); as.push(R12); as.push(R13); as.push(R15);
+            as.mov(JF, RDI);
+            as.load(SP, JF, JF_SP);
+            as.load(LOCALS, JF, (int32_t)offsetof(JitFrame, locals));
+            as.mov_imm(QNAN, Value::QNAN);
+            as.load32(RAX, JF, JF_ENTRY);
+            for(size_t ip = 1; ip < entry.size(); ++ip)
+            {
+                if(!entry[ip]) continue;
+                as.byte(0x3d);              // cmp eax, imm32
+                as.u32((uint32_t)ip);
+                as.jcc(CC_E, ip_label[ip]);
+            }
+        }
+
+        void epilogue()
+        {
+            as.bind(l_ret);
+            as.store(JF, JF_RET, RAX);
+            as.bind(l_exit);
+            as.store(JF, JF_SP, SP);
+            as.pop(R15); as.pop(R13); as.pop(R12); as.pop(RBP); as.pop(RBX);
+            as.ret();
+        }
+
+        // runs op through jit_slow, then continues at resume (or at target
+        // when the helper says the jump is taken)
+        void helper_call(const Op *op, int resume, int tgt)
+        {
+            as.store(JF, JF_SP, SP);
+            as.mov(RDI, JF);
+            as.mov_imm(RSI, (uint64_t)(uintptr_t)op);
+            as.call((const void *)&jit_slow);
+            as.load(SP, JF, JF_SP);
+            as.test32(RAX);
+            as.jcc(CC_S, l_exit);
+            if(tgt >= 0) as.jcc(CC_NE, tgt);
+            as.jmp(resume);
+        }
+
+        int stub(size_t ip, int tgt = -1)
+        {
+            Stub s{as.new_label(), &code[ip], ip_label[ip + 1], tgt};
+            stubs.push_back(s);
+            return s.entry;
+        }
+
+        void jump_on_string(int cc, int r, int label)
+        {
+            as.mov(RDX, r);
+            as.shr(RDX, 48);
+            as.cmp32_imm(RDX, (uint32_t)Value::TOP_STRING);
+            as.jcc(cc, label);
+        }
+        void jump_if_not_string(int r, int label) { jump_on_string(CC_NE, r, label); }
+
+        // Value copy / destruction of r inline: strings get their count
+        // bumped or dropped, and only the last release leaves the fast path.
+        // Both clobber rdx; a release clobbers the caller-saved registers
+        // when it frees, so it comes last in a template.
+        void retain(int r)
+        {
+            int done = as.new_label();
+            jump_if_not_string(r, done);
+            as.mov_imm(RDX, Value::PAYLOAD);
+            as.alu(0x21, RDX, r);
+            as.lock_inc32(RDX);
+            as.bind(done);
+        }
+
+        void release(int r)
+        {
+            int done = as.new_label();
+            jump_if_not_string(r, done);
+            as.mov_imm(RDX, Value::PAYLOAD);
+            as.alu(0x21, RDX, r);
+            as.lock_dec32(RDX);
+            Stub s{as.new_label(), nullptr, done, -1};
+            stubs.push_back(s);
+            as.jcc(CC_E, s.entry);
+            as.bind(done);
+        }
+
+        // rax = a constant, with the reference the copy owns
+        void load_const(const Value &k)
+        {
+            as.mov_imm(RAX, k.raw_bits());
+            if(k.is_string())
+            {
+                as.mov_imm(RDX, (uint64_t)(uintptr_t)k.string_object());
+                as.lock_inc32(RDX);
+            }
+        }
+
+        void jump_if_not_number(int r, int label)
+        {
+            as.mov(RDX, r);
+            as.alu(0x21, RDX, QNAN);
+            as.alu(0x39, RDX, QNAN);
+            as.jcc(CC_E, label);
+        }
+
+        // rax = xmm0 as a number Value (NaNs canonicalized)
+        void box_number()
+        {
+            int ok = as.new_label();
+            as.movq_from_xmm(RAX, XMM0);
+            as.ucomisd(XMM0, XMM0);
+            as.jcc(CC_NP, ok);
+            as.mov_imm(RAX, Value::CANON_NAN);
+            as.bind(ok);
+        }
+
+        // rax, rcx = the two operands of a binary op, both numbers, also
+        // in xmm0 / xmm1
+        // slow < 0: the compiler proved both are numbers (op.c, see
+        // bytecode.h), so there is nothing to check
+        void load_number_pair(int slow)
+        {
+            as.load(RAX, SP, -16);
+            as.load(RCX, SP, -8);
+            if(slow >= 0)
+            {
+                jump_if_not_number(RAX, slow);
+                jump_if_not_number(RCX, slow);
+            }
+            as.movq_to_xmm(XMM0, RAX);
+            as.movq_to_xmm(XMM1, RCX);
+        }
+
+        // replaces the two operands with rax
+        void store_binary_result()
+        {
+            as.store(SP, -16, RAX);
+            as.store(SP, -8, QNAN);
+            as.alu_imm(5, SP, 8);
+        }
+
+        // compares xmm0 (lhs) with xmm1 (rhs) for cmp in LT..NE
+        void compare_flags(OpCode cmp)
+        {
+            if(cmp == OP_LT || cmp == OP_LE) as.ucomisd(XMM1, XMM0);
+            else as.ucomisd(XMM0, XMM1);
+        }
+
+        // after compare_flags: jump to label when the comparison is false
+        // (unordered, i.e. NaN, is false for all but NE)
+        void jump_unless(OpCode cmp, int label)
+        {
+            switch(cmp)
+            {
+                case OP_LT: case OP_GT: as.jcc(CC_BE, label); break;
+                case OP_LE: case OP_GE: as.jcc(CC_B, label); break;
+                case OP_EQ:
+                    as.jcc(CC_P, label);
+                    as.jcc(CC_NE, label);
+                    break;
+                default:
+                {
+                    int holds = as.new_label();
+                    as.jcc(CC_P, holds);
+                    as.jcc(CC_E, label);
+                    as.bind(holds);
+                    break;
+                }
+            }
+        }
+
+        // after compare_flags: al = the comparison's result
+        void compare_to_al(OpCode cmp)
+        {
+            switch(cmp)
+            {
+                case OP_LT: case OP_GT: as.setcc(CC_A, RAX); break;
+                case OP_LE: case OP_GE: as.setcc(CC_AE, RAX); break;
+                case OP_EQ:
+                    as.setcc(CC_E, RAX);
+                    as.setcc(CC_NP, RCX);
+                    as.byte(0x20); as.byte(0xc8);   // and al, cl
+                    break;
+                default:
+                    as.setcc(CC_NE, RAX);
+                    as.setcc(CC_P, RCX);
+                    as.byte(0x08); as.byte(0xc8);   // or al, cl
+                    break;
+            }
+        }
+
+        // local b ==/!= an interned string constant: the same object is
+        // equal, a non-string or another interned string is not; only a
+        // non-interned string needs the content compare in jit_slow
+        void test_interned(const Op &op, bool eq, int next, int jump, int slow)
+        {
+            const StringObject *o = konst(op.c).string_object();
+            int32_t interned_at = (int32_t)((const char *)&o->interned - (const char *)o);
+            int same = eq ? next : jump, differs = eq ? jump : next;
+            as.load(RAX, LOCALS, slot(op.b));
+            as.mov_imm(RDX, konst(op.c).raw_bits());
+            as.alu(0x39, RAX, RDX);
+            as.jcc(CC_E, same);
+            jump_if_not_string(RAX, differs);
+            as.mov_imm(RDX, Value::PAYLOAD);
+            as.alu(0x21, RDX, RAX);
+            as.cmp8_zero(RDX, interned_at);
+            as.jcc(CC_E, slow);
+            as.jmp(differs);
+        }
+
+        // a compare whose result only feeds the JMP_IF_FALSE after it
+        bool fuses_with_branch(size_t ip) const
+        {
+            return ip + 1 < code.size() && generic_opcode(code[ip + 1].op) == OP_JMP_IF_FALSE &&
+                   !target[ip + 1];
+        }
+
+        void emit(size_t ip)
+        {
+            const Op &op = code[ip];
+            OpCode g = generic_opcode(op.op);
+            int next = ip_label[ip + 1];
+            switch(g)
+            {
+                case OP_NOP:
+                    break;
+
+                case OP_PUSH_CONST:
+                    load_const(konst(op.a));
+                    as.store(SP, 0, RAX);
+                    as.alu_imm(0, SP, 8);
+                    break;
+
+                case OP_PUSH_LOCAL:
+                    as.load(RAX, LOCALS, slot(op.a));
+                    retain(RAX);
+                    as.store(SP, 0, RAX);
+                    as.alu_imm(0, SP, 8);
+                    break;
+
+                case OP_PUSH_LOCAL_MOVE:
+                    as.load(RAX, LOCALS, slot(op.a));
+                    as.store(LOCALS, slot(op.a), QNAN);
+                    as.store(SP, 0, RAX);
+                    as.alu_imm(0, SP, 8);
+                    break;
+
+                case OP_STORE_LOCAL:
+                    as.load(RCX, LOCALS, slot(op.a));
+                    as.load(RAX, SP, -8);
+                    as.store(LOCALS, slot(op.a), RAX);
+                    as.store(SP, -8, QNAN);
+                    as.alu_imm(5, SP, 8);
+                    release(RCX);
+                    break;
+
+                case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+                {
+                    load_number_pair(op.c ? -1 : stub(ip));
+                    if(g == OP_DIV)
+                    {
+                        int divide = as.new_label(), done = as.new_label();
+                        as.xorpd(XMM2, XMM2);
+                        as.ucomisd(XMM1, XMM2);
+                        as.jcc(CC_P, divide);
+                        as.jcc(CC_NE, divide);
+                        as.xorpd(XMM0, XMM0);
+                        as.jmp(done);
+                        as.bind(divide);
+                        as.sd(0x5e, XMM0, XMM1);
+                        as.bind(done);
+                    }
+                    else as.sd(g == OP_ADD ? 0x58 : g == OP_SUB ? 0x5c : 0x59, XMM0, XMM1);
+                    box_number();
+                    store_binary_result();
+                    break;
+                }
+
+                case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+                    if(fuses_with_branch(ip))
+                    {
+                        // the slow path pushes the boolean and lets the
+                        // JMP_IF_FALSE template consume it
+                        load_number_pair(op.c ? -1 : stub(ip));
+                        as.store(SP, -16, QNAN);
+                        as.store(SP, -8, QNAN);
+                        as.alu_imm(5, SP, 16);
+                        compare_flags(g);
+                        jump_unless(g, ip_label[code[ip + 1].a]);
+                        as.jmp(ip_label[ip + 2]);
+                        break;
+                    }
+                    load_number_pair(op.c ? -1 : stub(ip));
+                    compare_flags(g);
+                    compare_to_al(g);
+                    as.byte(0x0f); as.byte(0xb6); as.byte(0xc0);    // movzx eax, al
+                    as.mov_imm(RDX, Value::FALSE_BITS);
+                    as.alu(0x01, RAX, RDX);
+                    store_binary_result();
+                    break;
+
+                case OP_POP:
+                    for(int n = 0; n < op.a; ++n)
+                    {
+                        as.load(RAX, SP, -8);
+                        as.store(SP, -8, QNAN);
+                        as.alu_imm(5, SP, 8);
+                        release(RAX);
+                    }
+                    break;
+
+                case OP_MOD: case OP_NOT: case OP_NEG:
+                case OP_CALL_HOST: case OP_CALL_HOST_NUM: case OP_CALL_HOST_POP:
+                    helper_call(&op, next, -1);
+                    break;
+
+                case OP_JMP:
+                    as.jmp(ip_label[op.a]);
+                    break;
+
+                case OP_JMP_IF_FALSE:
+                case OP_JMP_IF_TRUE:
+                {
+                    bool on_true = g == OP_JMP_IF_TRUE;
+                    int truthy = on_true ? ip_label[op.a] : next, falsy = on_true ? next : ip_label[op.a];
+                    int number = as.new_label(), other = as.new_label();
+                    as.load(RAX, SP, -8);
+                    as.store(SP, -8, QNAN);
+                    as.alu_imm(5, SP, 8);
+                    jump_if_not_string(RAX, other);
+                    release(RAX);                       // strings are truthy
+                    as.jmp(truthy);
+                    as.bind(other);
+                    as.mov(RDX, RAX);
+                    as.alu(0x21, RDX, QNAN);
+                    as.alu(0x39, RDX, QNAN);
+                    as.jcc(CC_NE, number);
+                    as.alu(0x39, RAX, QNAN);            // nil
+                    as.jcc(CC_E, falsy);
+                    as.mov_imm(RDX, Value::FALSE_BITS);
+                    as.alu(0x39, RAX, RDX);
+                    as.jcc(CC_E, falsy);
+                    as.jmp(truthy);
+                    as.bind(number);                    // +0.0 and -0.0 are falsy
+                    as.mov(RDX, RAX);
+                    as.alu(0x01, RDX, RDX);
+                    as.jcc(CC_E, falsy);
+                    if(on_true) as.jmp(truthy);
+                    break;
+                }
+
+                case OP_RET:
+                    if(depth[ip] > 0)
+                    {
+                        as.load(RAX, SP, -8);
+                        as.store(SP, -8, QNAN);
+                        as.alu_imm(5, SP, 8);
+                    }
+                    else as.mov(RAX, QNAN);
+                    as.jmp(l_ret);
+                    break;
+
+                case OP_RET_CONST:
+                    load_const(konst(op.a));
+                    as.jmp(l_ret);
+                    break;
+
+                case OP_PUSH_LOCAL2:
+                    as.load(RAX, LOCALS, slot(op.a));
+                    retain(RAX);
+                    as.store(SP, 0, RAX);
+                    as.load(RAX, LOCALS, slot(op.b));
+                    retain(RAX);
+                    as.store(SP, 8, RAX);
+                    as.alu_imm(0, SP, 16);
+                    break;
+
+                case OP_STORE_CONST:
+                    load_const(konst(op.b));
+                    as.load(RCX, LOCALS, slot(op.a));
+                    as.store(LOCALS, slot(op.a), RAX);
+                    release(RCX);
+                    break;
+
+                case OP_MOVE_LOCAL:
+                    // retain before release: x = x must not free x
+                    as.load(RAX, LOCALS, slot(op.b));
+                    retain(RAX);
+                    as.load(RCX, LOCALS, slot(op.a));
+                    as.store(LOCALS, slot(op.a), RAX);
+                    release(RCX);
+                    break;
+
+                case OP_INC_LOCAL:
+                    if(!konst(op.b).is_number()) { helper_call(&op, next, -1); break; }
+                    as.load(RAX, LOCALS, slot(op.a));
+                    jump_if_not_number(RAX, stub(ip));
+                    as.movq_to_xmm(XMM0, RAX);
+                    as.mov_imm(RDX, konst(op.b).raw_bits());
+                    as.movq_to_xmm(XMM1, RDX);
+                    as.sd(0x58, XMM0, XMM1);
+                    box_number();
+                    as.store(LOCALS, slot(op.a), RAX);
+                    break;
+
+                case OP_TEST_LT_LK: case OP_TEST_LE_LK: case OP_TEST_GT_LK:
+                case OP_TEST_GE_LK: case OP_TEST_EQ_LK: case OP_TEST_NE_LK:
+                {
+                    int jump = ip_label[op.a];
+                    const Value &k = konst(op.c);
+                    if((g == OP_TEST_EQ_LK || g == OP_TEST_NE_LK) && k.is_string() && k.string_object()->interned)
+                    {
+                        test_interned(op, g == OP_TEST_EQ_LK, next, jump, stub(ip, jump));
+                        break;
+                    }
+                    if(!k.is_number()) { helper_call(&op, next, jump); break; }
+                    OpCode cmp = (OpCode)(OP_LT + (g - OP_TEST_LT_LK));
+                    as.load(RAX, LOCALS, slot(op.b));
+                    jump_if_not_number(RAX, stub(ip, jump));
+                    as.movq_to_xmm(XMM0, RAX);
+                    as.mov_imm(RDX, konst(op.c).raw_bits());
+                    as.movq_to_xmm(XMM1, RDX);
+                    compare_flags(cmp);
+                    jump_unless(cmp, jump);
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+    };
+}
+
+JitCode::~JitCode()
+{
+    if(mem) munmap(mem, size);
+}
+
+JitCode *jit_compile(ByteFunc &f)
+{
+    if(f.jit) return f.jit.get();
+    if(f.jit_unsupported) return nullptr;
+
+    Translator t(f);
+    if(!t.run())
+    {
+        f.jit_unsupported = true;
+        dbg("JIT: function left to the interpreter");
+        return nullptr;
+    }
+
+    const vector<uint8_t> &bytes = t.bytes();
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (bytes.size() + page - 1) / page * page;
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+    {
+        f.jit_unsupported = true;
+        errlog("JIT: cannot map code memory");
+        return nullptr;
+    }
+    memcpy(mem, bytes.data(), bytes.size());
+    if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(mem, size);
+        f.jit_unsupported = true;
+        errlog("JIT: cannot make code memory executable");
+        return nullptr;
+    }
+
+    auto code = make_shared<JitCode>();
+    code->mem = mem;
+    code->size = size;
+    code->entry = reinterpret_cast<void (*)(JitFrame *)>(mem);
+    f.jit = move(code);
+    dbg("JIT: translated " + to_string(f.code.size()) + " instructions into " +
+        to_string(bytes.size()) + " bytes");
+    return f.jit.get();
+}
+
+#else
+
+JitCode::~JitCode() {}
+
+JitCode *jit_compile(ByteFunc &f)
+{
+    f.jit_unsupported = true;
+    return nullptr;
+}
+
+#endif
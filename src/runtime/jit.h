@@ -0,0 +1,81 @@
+#ifndef MONDOT_JIT_H
+#define MONDOT_JIT_H
+
+#include "bytecode.h"
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+// Baseline template JIT.
+//
+// A hot ByteFunc is translated once, instruction by instruction, into x86-64
+// code in its own mmap'd region. Every template keeps the interpreter's
+// stack layout (locals and operand stack stay in VM::stack, sp lives in a
+// register) and inlines only the number / boolean / nil fast paths; strings,
+// host calls and the rarer opcodes call jit_slow, which runs the generic
+// semantics from vm_ops.h. A function that contains an opcode the JIT does
+// not translate (script calls), or that fails the operand and stack-depth
+// checks, is marked and stays in the interpreter for good.
+//
+// The VM enters jitted code at a function's entry once it has been called
+// JIT_CALL_THRESHOLD times, or in the middle of a loop (at the target of a
+// backward JMP) once it has taken JIT_BACKEDGE_THRESHOLD back edges, so a
+// handler that runs a single long loop still gets compiled. The code runs
+// until the function returns.
+//
+// The code is owned by its ByteFunc and so by its Module: after a
+// hot_swap, the old module (and with it its code) is only deleted by
+// ModuleManager::tick_reclaim once active_calls has dropped to zero, and
+// jitted code only ever runs inside an execute_handler activation that
+// holds one of those calls.
+//
+// Only built with -DMONDOT_JIT=ON, and only on Linux x86-64; everywhere
+// else jit_compile always declines.
+#if MONDOT_JIT && defined(__x86_64__) && defined(__linux__)
+  #define MONDOT_JIT_ENABLED 1
+#else
+  #define MONDOT_JIT_ENABLED 0
+#endif
+
+enum class JitMode : uint8_t
+{
+    Off,        // interpret everything
+    Hot,        // translate functions that reach the thresholds
+    Eager       // translate every function on its first entry
+};
+
+constexpr uint32_t JIT_CALL_THRESHOLD = 64;
+constexpr uint32_t JIT_BACKEDGE_THRESHOLD = 1024;
+
+// What jitted code and its helpers share with the VM for one activation.
+// The generated code addresses the fields by offset.
+struct JitFrame
+{
+    Value *locals = nullptr;
+    Value *sp = nullptr;            // kept in a register, written back around helper calls
+    Value **top = nullptr;          // VM::top, synced before host calls
+    ByteFunc *func = nullptr;
+    HostBridge *host = nullptr;
+    uint32_t entry_ip = 0;          // 0, or a loop header for on-stack entry
+    Value ret;                      // the function's result
+    std::exception_ptr error;       // set when a helper caught an exception
+};
+
+// one translated function; unmapped with its ByteFunc
+struct JitCode
+{
+    void *mem = nullptr;
+    size_t size = 0;
+    void (*entry)(JitFrame *) = nullptr;
+
+    JitCode() = default;
+    JitCode(const JitCode &) = delete;
+    JitCode &operator=(const JitCode &) = delete;
+    ~JitCode();
+};
+
+// translates f unless that was already tried; returns nullptr when f stays
+// interpreted (f.jit_unsupported is then set)
+JitCode *jit_compile(ByteFunc &f);
+
+#endif
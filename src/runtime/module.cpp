@@ -4,14 +4,36 @@
 
 using namespace std;
 
-Module* module_from_compiled(const CompiledUnit &cu)
+// cu is taken by value: a lazy handler may only ever be compiled into one
+// module, the one whose LazyHandler (and once flag) it is
+Module* module_from_compiled(CompiledUnit cu, HostBridge &host)
 {
     Module *m = new Module();
     m->name = cu.module.name;
-    m->bytecode = cu.module;
+    m->bytecode = move(cu.module);
+    link_host_calls(m->bytecode, host);
     return m;
 }
 
+void link_host_calls(ByteModule &bm, HostBridge &host)
+{
+    for(auto &f : bm.funcs)
+        for(auto &site : f.host_calls)
+            host.resolve(site);
+}
+
+void compile_pending(ByteModule &bm, ByteFunc &f, HostBridge &host)
+{
+    LazyHandler &l = *f.lazy;
+    call_once(l.once, [&]
+    {
+        compile_lazy_handler(bm, f);
+        for(auto &site : f.host_calls)
+            host.resolve(site);
+        l.compiled.store(true, memory_order_release);
+    });
+}
+
 ModuleManager G_MODULES;
 atomic_flag super_called = ATOMIC_FLAG_INIT;
 
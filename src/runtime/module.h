@@ -2,6 +2,7 @@
 #define MONDOT_MODULE_H
 
 #include "bytecode.h"
+#include "host.h"
 #include <atomic>
 #include <string>
 #include <unordered_map>
@@ -33,6 +34,19 @@ struct ModuleManager
 extern ModuleManager G_MODULES;
 extern std::atomic_flag super_called;
 
-Module* module_from_compiled(const CompiledUnit &cu);
+Module* module_from_compiled(CompiledUnit cu, HostBridge &host = GLOBAL_HOST);
+void link_host_calls(ByteModule &bm, HostBridge &host);
+
+// Compiles f, a handler of bm left to its first call (CompileOptions::lazy),
+// and links its host calls, unless that already happened. Threads may race
+// to a handler's first call: one compiles, the others wait for it. A
+// compile error is thrown to the callers at hand and the next call retries.
+void compile_pending(ByteModule &bm, ByteFunc &f, HostBridge &host);
+
+// to be called before f runs
+inline void ensure_compiled(ByteModule &bm, ByteFunc &f, HostBridge &host)
+{
+    if(f.lazy && !f.lazy->compiled.load(std::memory_order_acquire)) compile_pending(bm, f, host);
+}
 
 #endif
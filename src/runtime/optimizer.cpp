@@ -0,0 +1,377 @@
+#include "optimizer.h"
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+static vector<bool> jump_targets(const ByteFunc &f)
+{
+    vector<bool> target(f.code.size() + 1, false);
+    for(auto &op : f.code)
+        if(is_jump_op(op.op) && op.a >= 0 && (size_t)op.a < target.size())
+            target[op.a] = true;
+    return target;
+}
+
+// drops the instructions flagged in 'removed' and remaps every jump target
+// to the new position of the instruction it pointed at (or the next one
+// kept after it)
+static void compact(ByteFunc &f, const vector<bool> &removed)
+{
+    vector<int> new_ip(f.code.size() + 1, 0);
+    size_t out = 0;
+    for(size_t ip = 0; ip < f.code.size(); ++ip)
+    {
+        new_ip[ip] = (int)out;
+        if(!removed[ip]) f.code[out++] = f.code[ip];
+    }
+    new_ip[f.code.size()] = (int)out;
+    f.code.resize(out);
+
+    for(auto &op : f.code)
+        if(is_jump_op(op.op) && op.a >= 0 && (size_t)op.a < new_ip.size())
+            op.a = new_ip[op.a];
+}
+
+static bool ends_flow(OpCode op)
+{
+    return op == OP_JMP || op == OP_RET || op == OP_RET_CONST;
+}
+
+// end of a chain of unconditional jumps, or t itself when the chain loops
+static int final_target(const vector<Op> &code, int t)
+{
+    int cur = t;
+    for(size_t hops = 0; cur >= 0 && (size_t)cur < code.size() && code[cur].op == OP_JMP; ++hops)
+    {
+        if(hops > code.size()) return t;
+        cur = code[cur].a;
+    }
+    return cur;
+}
+
+static bool thread_jumps(ByteFunc &f)
+{
+    vector<Op> &code = f.code;
+    bool changed = false;
+    for(auto &op : code)
+    {
+        if(!is_jump_op(op.op)) continue;
+        int t = final_target(code, op.a);
+        if(t != op.a)
+        {
+            op.a = t;
+            changed = true;
+        }
+        if(op.op == OP_JMP && t >= 0 && (size_t)t < code.size() &&
+           (code[t].op == OP_RET || code[t].op == OP_RET_CONST))
+        {
+            op = code[t];
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static bool is_conditional_jump(OpCode op)
+{
+    return op == OP_JMP_IF_FALSE || op == OP_JMP_IF_TRUE;
+}
+
+// PUSH_CONST k; JMP_IF_FALSE t  ->  JMP t, or nothing when k is truthy
+// (and the other way round for JMP_IF_TRUE)
+static bool fold_constant_branches(ByteFunc &f)
+{
+    vector<Op> &code = f.code;
+    vector<bool> target = jump_targets(f);
+    vector<bool> removed(code.size(), false);
+    bool changed = false;
+    for(size_t ip = 0; ip + 1 < code.size(); ++ip)
+    {
+        const Op &k = code[ip];
+        Op &jif = code[ip+1];
+        if(k.op != OP_PUSH_CONST || !is_conditional_jump(jif.op) || target[ip+1]) continue;
+        if(k.a < 0 || (size_t)k.a >= f.consts->size()) continue;
+
+        removed[ip] = true;
+        if(is_truthy((*f.consts)[k.a]) != (jif.op == OP_JMP_IF_TRUE)) removed[ip+1] = true;
+        else jif = Op(OP_JMP, jif.a);
+        changed = true;
+        ++ip;
+    }
+    if(changed) compact(f, removed);
+    return changed;
+}
+
+static bool remove_unreachable(ByteFunc &f)
+{
+    const vector<Op> &code = f.code;
+    vector<bool> reached(code.size(), false);
+    vector<size_t> work{0};
+    while(!work.empty())
+    {
+        size_t ip = work.back();
+        work.pop_back();
+        if(ip >= code.size() || reached[ip]) continue;
+        reached[ip] = true;
+        const Op &op = code[ip];
+        if(is_jump_op(op.op) && op.a >= 0) work.push_back((size_t)op.a);
+        if(!ends_flow(op.op)) work.push_back(ip + 1);
+    }
+
+    vector<bool> removed(code.size(), false);
+    bool changed = false;
+    for(size_t ip = 0; ip < code.size(); ++ip)
+        if(!reached[ip]) removed[ip] = changed = true;
+    if(changed) compact(f, removed);
+    return changed;
+}
+
+static bool remove_jumps_to_next(ByteFunc &f)
+{
+    vector<Op> &code = f.code;
+    vector<bool> removed(code.size(), false);
+    bool changed = false;
+    for(size_t ip = 0; ip < code.size(); ++ip)
+    {
+        Op &op = code[ip];
+        if((op.op != OP_JMP && !is_conditional_jump(op.op)) || op.a != (int)ip + 1) continue;
+        // a conditional jump to the next instruction still consumes its condition
+        if(op.op != OP_JMP) op = Op(OP_POP, 1);
+        else removed[ip] = true;
+        changed = true;
+    }
+    if(changed) compact(f, removed);
+    return changed;
+}
+
+void optimize_jumps(ByteFunc &f)
+{
+    // threading is idempotent and every other step shrinks the code, so
+    // this reaches a fixed point
+    for(bool changed = true; changed; )
+    {
+        changed = thread_jumps(f);
+        changed |= fold_constant_branches(f);
+        changed |= remove_unreachable(f);
+        changed |= remove_jumps_to_next(f);
+    }
+}
+
+static OpCode test_opcode(OpCode cmp)
+{
+    switch(cmp)
+    {
+        case OP_LT: return OP_TEST_LT_LK;
+        case OP_LE: return OP_TEST_LE_LK;
+        case OP_GT: return OP_TEST_GT_LK;
+        case OP_GE: return OP_TEST_GE_LK;
+        case OP_EQ: return OP_TEST_EQ_LK;
+        case OP_NE: return OP_TEST_NE_LK;
+        default:    return OP_NOP;
+    }
+}
+
+void fuse_superinstructions(ByteFunc &f)
+{
+    vector<Op> &code = f.code;
+    vector<bool> target = jump_targets(f);
+    vector<bool> removed(code.size(), false);
+
+    auto local_ok = [&](int i, size_t limit) { return i >= 0 && (size_t)i < f.locals.size() && (size_t)i <= limit; };
+    auto const_ok = [&](int i, size_t limit) { return i >= 0 && (size_t)i < f.consts->size() && (size_t)i <= limit; };
+    // instructions ip+1 .. ip+n-1 exist and none of them is entered by a jump
+    auto fusible = [&](size_t ip, size_t n)
+    {
+        if(ip + n > code.size()) return false;
+        for(size_t k = 1; k < n; ++k)
+            if(target[ip + k]) return false;
+        return true;
+    };
+    auto fuse = [&](size_t ip, size_t n, Op op)
+    {
+        code[ip] = op;
+        for(size_t k = 1; k < n; ++k) removed[ip + k] = true;
+    };
+
+    for(size_t ip = 0; ip < code.size(); ++ip)
+    {
+        const Op &o = code[ip];
+        switch(o.op)
+        {
+            case OP_PUSH_LOCAL:
+            {
+                if(fusible(ip, 4) && code[ip+1].op == OP_PUSH_CONST)
+                {
+                    const Op &k = code[ip+1], &x = code[ip+2], &y = code[ip+3];
+                    // x = x + k
+                    if(x.op == OP_ADD && y.op == OP_STORE_LOCAL && y.a == o.a &&
+                       local_ok(o.a, SIZE_MAX) && const_ok(k.a, MAX_B_OPERAND))
+                    {
+                        fuse(ip, 4, Op(OP_INC_LOCAL, o.a, k.a));
+                        ip += 3;
+                        break;
+                    }
+                    // if/while (x <op> k)
+                    if(test_opcode(x.op) != OP_NOP && y.op == OP_JMP_IF_FALSE &&
+                       local_ok(o.a, MAX_B_OPERAND) && const_ok(k.a, MAX_C_OPERAND))
+                    {
+                        fuse(ip, 4, Op(test_opcode(x.op), y.a, o.a, k.a));
+                        ip += 3;
+                        break;
+                    }
+                }
+                if(fusible(ip, 2) && local_ok(o.a, SIZE_MAX))
+                {
+                    const Op &n = code[ip+1];
+                    if(n.op == OP_PUSH_LOCAL && local_ok(n.a, MAX_B_OPERAND))
+                    {
+                        fuse(ip, 2, Op(OP_PUSH_LOCAL2, o.a, n.a));
+                        ++ip;
+                    }
+                    else if(n.op == OP_STORE_LOCAL && local_ok(n.a, SIZE_MAX) && local_ok(o.a, MAX_B_OPERAND))
+                    {
+                        fuse(ip, 2, Op(OP_MOVE_LOCAL, n.a, o.a));
+                        ++ip;
+                    }
+                }
+                break;
+            }
+            case OP_PUSH_CONST:
+            {
+                if(!fusible(ip, 2)) break;
+                const Op &n = code[ip+1];
+                if(n.op == OP_STORE_LOCAL && local_ok(n.a, SIZE_MAX) && const_ok(o.a, MAX_B_OPERAND))
+                {
+                    fuse(ip, 2, Op(OP_STORE_CONST, n.a, o.a));
+                    ++ip;
+                }
+                else if(n.op == OP_RET && const_ok(o.a, SIZE_MAX))
+                {
+                    fuse(ip, 2, Op(OP_RET_CONST, o.a));
+                    ++ip;
+                }
+                break;
+            }
+            case OP_CALL_HOST:
+            {
+                if(fusible(ip, 2) && code[ip+1].op == OP_POP && code[ip+1].a == 1)
+                {
+                    fuse(ip, 2, Op(OP_CALL_HOST_POP, o.a, o.b));
+                    ++ip;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    compact(f, removed);
+}
+
+// Locals an instruction reads (use), and the ones it overwrites when it
+// falls through (fall) and when it jumps (jump). Only use needs to be
+// exact: a missed write merely keeps a local live for longer.
+struct LocalEffects
+{
+    vector<int> use, fall, jump;
+};
+
+static void local_effects(const Op &op, LocalEffects &e)
+{
+    e.use.clear();
+    e.fall.clear();
+    e.jump.clear();
+    switch(op.op)
+    {
+        case OP_PUSH_LOCAL:
+        case OP_PUSH_LOCAL_MOVE:
+            e.use = {op.a};
+            break;
+        case OP_PUSH_LOCAL2:
+            e.use = {op.a, op.b};
+            break;
+        case OP_STORE_LOCAL:
+        case OP_STORE_CONST:
+            e.fall = {op.a};
+            break;
+        case OP_MOVE_LOCAL:
+            e.use = {op.b};
+            e.fall = {op.a};
+            break;
+        case OP_INC_LOCAL:
+            e.use = {op.a};
+            e.fall = {op.a};
+            break;
+        case OP_TEST_LT_LK: case OP_TEST_LE_LK: case OP_TEST_GT_LK:
+        case OP_TEST_GE_LK: case OP_TEST_EQ_LK: case OP_TEST_NE_LK:
+            e.use = {op.b};
+            break;
+        case OP_ITER_PREP:
+            e.fall = {op.a, op.a + 1};
+            break;
+        case OP_ITER_NEXT:
+            e.use = {op.b, op.b + 1};
+            break;
+        case OP_FORPREP:
+            // stores all four only when the loop runs
+            e.fall = {op.b, op.b + 1, op.b + 2, op.b + 3};
+            break;
+        case OP_FORLOOP:
+            e.use = {op.b, op.b + 1, op.b + 2};
+            e.jump = {op.b, op.b + 3};
+            break;
+        default:
+            break;
+    }
+}
+
+void move_last_uses(ByteFunc &f)
+{
+    vector<Op> &code = f.code;
+    size_t n = code.size(), words = (f.locals.size() + 63) / 64;
+    if(n == 0 || words == 0) return;
+
+    // live[ip] = locals live on entry to ip, one bit each; iterated
+    // backwards to a fixed point (loops need more than one pass)
+    vector<uint64_t> live((n + 1) * words, 0);
+    vector<uint64_t> in(words), edge(words);
+    LocalEffects e;
+    auto live_at = [&](size_t ip) { return &live[ip * words]; };
+    // in |= live[to] minus the locals written on the way there
+    auto merge = [&](size_t to, const vector<int> &written)
+    {
+        copy(live_at(to), live_at(to) + words, edge.begin());
+        for(int d : written) edge[d / 64] &= ~(1ull << (d % 64));
+        for(size_t w = 0; w < words; ++w) in[w] |= edge[w];
+    };
+
+    for(bool changed = true; changed; )
+    {
+        changed = false;
+        for(size_t ip = n; ip-- > 0; )
+        {
+            const Op &op = code[ip];
+            local_effects(op, e);
+            fill(in.begin(), in.end(), 0);
+            if(!ends_flow(op.op)) merge(ip + 1, e.fall);
+            if(is_jump_op(op.op) && op.a >= 0 && (size_t)op.a < n)
+                merge((size_t)op.a, e.jump);
+            for(int u : e.use) in[u / 64] |= 1ull << (u % 64);
+            uint64_t *cur = live_at(ip);
+            if(equal(in.begin(), in.end(), cur)) continue;
+            copy(in.begin(), in.end(), cur);
+            changed = true;
+        }
+    }
+
+    // a PUSH_LOCAL falls through to ip + 1, which has to do without it
+    for(size_t ip = 0; ip < n; ++ip)
+    {
+        Op &op = code[ip];
+        if(op.op == OP_PUSH_LOCAL && !(live_at(ip + 1)[op.a / 64] >> (op.a % 64) & 1))
+            op.op = OP_PUSH_LOCAL_MOVE;
+    }
+}
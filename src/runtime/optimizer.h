@@ -0,0 +1,28 @@
+#ifndef MONDOT_OPTIMIZER_H
+#define MONDOT_OPTIMIZER_H
+
+#include "bytecode.h"
+
+// Post-passes over ByteFunc::code, run by compile_unit once a handler has
+// been fully emitted.
+
+// Jump cleanup, iterated to a fixed point: threads jump-to-jump chains
+// (and turns a jump to a return into the return), folds JMP_IF_FALSE /
+// JMP_IF_TRUE on a constant condition, drops unreachable code (e.g. after
+// RET) and removes jumps to the next instruction.
+void optimize_jumps(ByteFunc &f);
+
+// Rewrites the hottest opcode sequences (see `mondot <dir> --opcode-pairs`)
+// into single superinstructions. A sequence is only fused when none of its
+// inner instructions is a jump target and all operands fit the encoding and
+// index valid locals/consts, so the VM handlers need no range checks.
+void fuse_superinstructions(ByteFunc &f);
+
+// Turns every PUSH_LOCAL that is the last read of its local before the
+// local is overwritten or the function returns into PUSH_LOCAL_MOVE, found
+// by a backward liveness pass over the final code. A moved string skips
+// the reference count increment of the copy and the decrement when the
+// local is later overwritten.
+void move_last_uses(ByteFunc &f);
+
+#endif
@@ -0,0 +1,1201 @@
+#include "ssa.h"
+#include "host.h"
+#include "vm_ops.h"
+#include "util.h"
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <ostream>
+
+using namespace std;
+
+static bool ends_flow(OpCode op)
+{
+    return op == OP_JMP || op == OP_RET || op == OP_RET_CONST;
+}
+
+// the instructions compile_unit emits; everything else only exists after
+// the later passes
+static bool naive_op(OpCode op)
+{
+    switch(op)
+    {
+        case OP_NOP: case OP_PUSH_CONST: case OP_PUSH_LOCAL: case OP_STORE_LOCAL:
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+        case OP_NOT: case OP_NEG:
+        case OP_CALL: case OP_CALL_DYNAMIC: case OP_CALL_HOST: case OP_CALL_HOST_NUM:
+        case OP_POP: case OP_RET: case OP_JMP: case OP_JMP_IF_FALSE: case OP_JMP_IF_TRUE:
+        case OP_ITER_PREP: case OP_ITER_NEXT: case OP_FORPREP: case OP_FORLOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// ADD..NE, NOT, NEG
+static bool operator_op(OpCode op)
+{
+    return op >= OP_ADD && op <= OP_NEG;
+}
+
+static bool host_call_op(OpCode op)
+{
+    return op == OP_CALL_HOST || op == OP_CALL_HOST_NUM;
+}
+
+static bool pure_site(const ByteFunc &f, int site)
+{
+    HostSignature sig;
+    return (size_t)site < f.host_calls.size() &&
+           HostManifest::signature(f.host_calls[site].name, sig) && sig.pure;
+}
+
+bool SsaFunc::dominates(int a, int b) const
+{
+    // the entry block is its own idom
+    while(b >= 0)
+    {
+        if(a == b) return true;
+        int up = blocks[b].idom;
+        if(up == b) return false;
+        b = up;
+    }
+    return false;
+}
+
+bool build_ssa(const ByteFunc &f, SsaFunc &s)
+{
+    const vector<Op> &code = f.code;
+    size_t n = code.size(), nl = f.locals.size();
+    s = SsaFunc();
+    if(n == 0 || !ends_flow(code.back().op)) return false;
+    for(const Op &op : code)
+    {
+        if(!naive_op(op.op)) return false;
+        if(is_jump_op(op.op) && (op.a < 0 || (size_t)op.a >= n)) return false;
+    }
+
+    // basic blocks: a jump target or whatever follows a jump starts one
+    vector<bool> leader(n + 1, false);
+    leader[0] = true;
+    for(size_t ip = 0; ip < n; ++ip)
+    {
+        const Op &op = code[ip];
+        if(is_jump_op(op.op)) leader[op.a] = true;
+        if(is_jump_op(op.op) || ends_flow(op.op)) leader[ip + 1] = true;
+    }
+    s.block_of.assign(n, -1);
+    for(size_t ip = 0; ip < n; ++ip)
+    {
+        if(leader[ip])
+        {
+            s.blocks.emplace_back();
+            s.blocks.back().begin = (int)ip;
+        }
+        s.blocks.back().end = (int)ip + 1;
+        s.block_of[ip] = (int)s.blocks.size() - 1;
+    }
+    size_t nb = s.blocks.size();
+    vector<vector<SsaEdge>> succ(nb);
+    for(size_t b = 0; b < nb; ++b)
+    {
+        const Op &last = code[s.blocks[b].end - 1];
+        if(!ends_flow(last.op)) succ[b].push_back({s.block_of[s.blocks[b].end], false});
+        if(is_jump_op(last.op)) succ[b].push_back({s.block_of[last.a], true});
+    }
+
+    // reverse postorder of the reachable blocks
+    vector<int> post;
+    vector<bool> seen(nb, false);
+    vector<pair<int,size_t>> dfs{{0, 0}};
+    seen[0] = true;
+    while(!dfs.empty())
+    {
+        int b = dfs.back().first;
+        size_t &i = dfs.back().second;
+        if(i < succ[b].size())
+        {
+            int t = succ[b][i++].block;
+            if(!seen[t])
+            {
+                seen[t] = true;
+                dfs.push_back({t, 0});
+            }
+        }
+        else
+        {
+            post.push_back(b);
+            dfs.pop_back();
+        }
+    }
+    s.rpo.assign(post.rbegin(), post.rend());
+    vector<int> rpo_index(nb, -1);
+    for(size_t i = 0; i < s.rpo.size(); ++i) rpo_index[s.rpo[i]] = (int)i;
+
+    s.blocks[0].preds.push_back({-1, false});
+    for(int b : s.rpo)
+        for(const SsaEdge &e : succ[b])
+        {
+            s.blocks[b].succs.push_back(e);
+            s.blocks[e.block].preds.push_back({b, e.jump});
+        }
+
+    // dominators (Cooper, Harvey, Kennedy)
+    s.blocks[0].idom = 0;
+    auto intersect = [&](int a, int b)
+    {
+        while(a != b)
+        {
+            while(rpo_index[a] > rpo_index[b]) a = s.blocks[a].idom;
+            while(rpo_index[b] > rpo_index[a]) b = s.blocks[b].idom;
+        }
+        return a;
+    };
+    for(bool changed = true; changed; )
+    {
+        changed = false;
+        for(size_t i = 1; i < s.rpo.size(); ++i)
+        {
+            SsaBlock &blk = s.blocks[s.rpo[i]];
+            int idom = -1;
+            for(const SsaEdge &p : blk.preds)
+                if(p.block >= 0 && s.blocks[p.block].idom >= 0)
+                    idom = idom < 0 ? p.block : intersect(p.block, idom);
+            if(idom != blk.idom)
+            {
+                blk.idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    auto add_value = [&](SsaValue::Kind kind, int block, int ip, int local, vector<int> args)
+    {
+        s.values.push_back(SsaValue{kind, block, ip, local, move(args)});
+        return (int)s.values.size() - 1;
+    };
+
+    // locals and operand stack at a point, as values
+    struct State
+    {
+        vector<int> locals, stack;
+    };
+    State entry;
+    for(size_t l = 0; l < nl; ++l) entry.locals.push_back(add_value(SsaValue::Entry, 0, -1, (int)l, {}));
+    vector<State> out_fall(nb), out_jump(nb);
+    vector<bool> done(nb, false);
+    auto out_state = [&](const SsaEdge &p) -> const State &
+    {
+        if(p.block < 0) return entry;
+        return p.jump ? out_jump[p.block] : out_fall[p.block];
+    };
+
+    s.result.assign(n, -1);
+    s.tree_start.assign(n, -1);
+    s.operands.assign(n, {});
+    s.local_reads.assign(n, {});
+
+    for(int b : s.rpo)
+    {
+        SsaBlock &blk = s.blocks[b];
+        State st;
+        // a block with one predecessor that is already done continues its
+        // state; every other one starts from phis, filled in below
+        if(blk.preds.size() == 1 && (blk.preds[0].block < 0 || done[blk.preds[0].block]))
+            st = out_state(blk.preds[0]);
+        else
+        {
+            size_t depth = 0;
+            for(const SsaEdge &p : blk.preds)
+                if(p.block < 0 || done[p.block])
+                {
+                    depth = out_state(p).stack.size();
+                    break;
+                }
+            for(size_t l = 0; l < nl; ++l)
+            {
+                st.locals.push_back(add_value(SsaValue::Phi, b, -1, (int)l, {}));
+                blk.phis.push_back(st.locals.back());
+            }
+            for(size_t i = 0; i < depth; ++i)
+            {
+                st.stack.push_back(add_value(SsaValue::Phi, b, -1, -1, {}));
+                blk.phis.push_back(st.stack.back());
+            }
+        }
+        blk.entry_stack = st.stack;
+
+        // where the expression tree of each stack entry starts; unknown for
+        // what the block inherits
+        vector<int> starts(st.stack.size(), -1);
+        for(int ip = blk.begin; ip < blk.end; ++ip)
+        {
+            const Op &op = code[ip];
+            auto pop = [&](size_t k)
+            {
+                if(st.stack.size() < k) return -2;
+                size_t base = st.stack.size() - k;
+                int start = k ? starts[base] : ip;
+                for(size_t i = base; i < st.stack.size(); ++i)
+                {
+                    s.operands[ip].push_back(st.stack[i]);
+                    if(starts[i] < 0) start = -1;
+                }
+                st.stack.resize(base);
+                starts.resize(base);
+                return start;
+            };
+            auto push = [&](SsaValue::Kind kind, int start)
+            {
+                int v = add_value(kind, b, ip, -1, s.operands[ip]);
+                st.stack.push_back(v);
+                starts.push_back(start);
+                s.result[ip] = v;
+                s.tree_start[ip] = start;
+            };
+            auto write = [&](State &to, int l, SsaValue::Kind kind, vector<int> args)
+            {
+                to.locals[l] = add_value(kind, b, ip, l, move(args));
+            };
+            auto local_ok = [&](int l, int count) { return l >= 0 && (size_t)l + count <= nl; };
+
+            int start = ip;
+            switch(op.op)
+            {
+                case OP_NOP:
+                case OP_JMP:
+                    break;
+                case OP_PUSH_CONST:
+                    push(SsaValue::Const, ip);
+                    break;
+                case OP_PUSH_LOCAL:
+                    if(!local_ok(op.a, 1)) return false;
+                    push(SsaValue::Read, ip);
+                    s.values[s.result[ip]].args = {st.locals[op.a]};
+                    break;
+                case OP_STORE_LOCAL:
+                    if(!local_ok(op.a, 1) || (start = pop(1)) == -2) return false;
+                    write(st, op.a, SsaValue::Store, s.operands[ip]);
+                    break;
+                case OP_NOT:
+                case OP_NEG:
+                    if((start = pop(1)) == -2) return false;
+                    push(SsaValue::Pure, start);
+                    break;
+                case OP_CALL:
+                case OP_CALL_DYNAMIC:
+                case OP_CALL_HOST:
+                case OP_CALL_HOST_NUM:
+                {
+                    size_t k = op.op == OP_CALL_DYNAMIC ? (size_t)op.a + 1 : (size_t)op.a;
+                    if(op.a < 0 || (start = pop(k)) == -2) return false;
+                    bool pure = host_call_op(op.op) && pure_site(f, op.b);
+                    push(pure ? SsaValue::Pure : SsaValue::Effect, start);
+                    break;
+                }
+                case OP_POP:
+                    if(op.a < 0 || pop((size_t)op.a) == -2) return false;
+                    break;
+                case OP_RET:
+                    if(!st.stack.empty()) pop(1);
+                    break;
+                case OP_JMP_IF_FALSE:
+                case OP_JMP_IF_TRUE:
+                    if(pop(1) == -2) return false;
+                    break;
+                case OP_ITER_PREP:
+                    if(!local_ok(op.a, 2) || pop(1) == -2) return false;
+                    write(st, op.a, SsaValue::Effect, s.operands[ip]);
+                    write(st, op.a + 1, SsaValue::Effect, {});
+                    break;
+                case OP_ITER_NEXT:
+                    // pushes the char and advances the index only when it
+                    // falls through
+                    if(!local_ok(op.b, 2)) return false;
+                    s.local_reads[ip] = {st.locals[op.b], st.locals[op.b + 1]};
+                    out_jump[b] = st;
+                    write(st, op.b + 1, SsaValue::Effect, {});
+                    push(SsaValue::Effect, ip);
+                    break;
+                case OP_FORPREP:
+                    if(!local_ok(op.b, 4) || pop(3) == -2) return false;
+                    out_jump[b] = st;
+                    for(int l = op.b; l < op.b + 4; ++l) write(st, l, SsaValue::Effect, {});
+                    break;
+                case OP_FORLOOP:
+                    if(!local_ok(op.b, 4)) return false;
+                    s.local_reads[ip] = {st.locals[op.b], st.locals[op.b + 1], st.locals[op.b + 2]};
+                    out_jump[b] = st;
+                    write(out_jump[b], op.b, SsaValue::Effect, {});
+                    write(out_jump[b], op.b + 3, SsaValue::Effect, {});
+                    break;
+                default:
+                    // ADD..NE
+                    if((start = pop(2)) == -2) return false;
+                    push(SsaValue::Pure, start);
+                    break;
+            }
+            // the other jumps leave the state as it is on both edges
+            if(is_jump_op(op.op) && op.op != OP_ITER_NEXT && op.op != OP_FORPREP && op.op != OP_FORLOOP)
+                out_jump[b] = st;
+        }
+        out_fall[b] = st;
+        done[b] = true;
+    }
+
+    // phi args, one per predecessor
+    for(int b : s.rpo)
+    {
+        SsaBlock &blk = s.blocks[b];
+        for(int phi : blk.phis)
+        {
+            SsaValue &v = s.values[phi];
+            size_t slot = 0;
+            if(v.local < 0)
+                slot = find(blk.entry_stack.begin(), blk.entry_stack.end(), phi) - blk.entry_stack.begin();
+            for(const SsaEdge &p : blk.preds)
+            {
+                const State &from = out_state(p);
+                if(v.local >= 0) v.args.push_back(from.locals[v.local]);
+                else if(slot < from.stack.size() && from.stack.size() == blk.entry_stack.size())
+                    v.args.push_back(from.stack[slot]);
+                else
+                    return false;
+            }
+        }
+    }
+
+    // a phi whose args are all one value (or the phi itself, around a
+    // loop) is that value
+    vector<int> repl(s.values.size());
+    for(size_t v = 0; v < repl.size(); ++v) repl[v] = (int)v;
+    auto find_repl = [&](int v)
+    {
+        while(repl[v] != v) v = repl[v] = repl[repl[v]];
+        return v;
+    };
+    for(bool changed = true; changed; )
+    {
+        changed = false;
+        for(int b : s.rpo)
+            for(int phi : s.blocks[b].phis)
+            {
+                if(find_repl(phi) != phi) continue;
+                int same = -1;
+                bool trivial = true;
+                for(int a : s.values[phi].args)
+                {
+                    a = find_repl(a);
+                    if(a == phi || a == same) continue;
+                    if(same >= 0) { trivial = false; break; }
+                    same = a;
+                }
+                if(trivial && same >= 0)
+                {
+                    repl[phi] = same;
+                    changed = true;
+                }
+            }
+    }
+    for(SsaValue &v : s.values)
+        for(int &a : v.args) a = find_repl(a);
+    for(auto &ops : s.operands)
+        for(int &a : ops) a = find_repl(a);
+    for(auto &reads : s.local_reads)
+        for(int &a : reads) a = find_repl(a);
+    for(SsaBlock &blk : s.blocks)
+    {
+        for(int &a : blk.entry_stack) a = find_repl(a);
+        vector<int> kept;
+        for(int phi : blk.phis)
+        {
+            if(find_repl(phi) == phi) kept.push_back(phi);
+            else
+            {
+                s.values[phi].block = -1;
+                s.values[phi].args.clear();
+            }
+        }
+        blk.phis = move(kept);
+    }
+    return true;
+}
+
+namespace
+{
+    // constant propagation lattice: no value seen yet, one constant, or
+    // anything
+    struct Lattice
+    {
+        enum State : uint8_t { Top, Const, Bottom } state = Top;
+        Value k;
+    };
+
+    bool same_const(const Value &a, const Value &b)
+    {
+        if(a.raw_bits() == b.raw_bits()) return true;
+        return a.is_string() && b.is_string() && a.str() == b.str();
+    }
+
+    void meet(Lattice &into, const Lattice &x)
+    {
+        if(x.state == Lattice::Top || into.state == Lattice::Bottom) return;
+        if(into.state == Lattice::Top || x.state == Lattice::Bottom) into = x;
+        else if(!same_const(into.k, x.k)) into.state = Lattice::Bottom;
+    }
+
+    // longest string a folded call may leave in the constant pool
+    constexpr size_t MAX_FOLDED_STRING = 4096;
+
+    // a pure host call over constant arguments, run now with the function
+    // registered at compile time (HostManifest::fold_slot); Bottom when the
+    // function may not be folded, throws, or returns what the constant
+    // pool cannot hold
+    Lattice fold_host_call(const string &name, const vector<Value> &args)
+    {
+        Lattice r;
+        r.state = Lattice::Bottom;
+        const HostSlot *slot = HostManifest::fold_slot(name);
+        if(!slot) return r;
+        Value k;
+        try { k = slot->call(ArgSpan{args.data(), args.size()}); }
+        catch(...) { return r; }
+        if(k.tag() == Tag::Rule || (k.is_string() && k.str().size() > MAX_FOLDED_STRING)) return r;
+        r.state = Lattice::Const;
+        r.k = k;
+        return r;
+    }
+
+    // static types: the set of tags a value may have at run time (none
+    // yet: not reached so far), plus T_BOUND when its being a number rests
+    // on a host binding's published result type, which stops holding if
+    // the name is re-registered
+    enum : uint8_t
+    {
+        T_NIL = 1, T_BOOL = 2, T_NUM = 4, T_STR = 8, T_RULE = 16,
+        T_ANY = T_NIL | T_BOOL | T_NUM | T_STR | T_RULE,
+        T_BOUND = 32
+    };
+
+    uint8_t type_of_const(const Value &k)
+    {
+        switch(k.tag())
+        {
+            case Tag::Nil: return T_NIL;
+            case Tag::Boolean: return T_BOOL;
+            case Tag::Number: return T_NUM;
+            case Tag::String: return T_STR;
+            default: return T_RULE;
+        }
+    }
+
+    // a number, as the typed forms of the operators and host calls need;
+    // bound ones only for instructions that still check
+    bool is_num(uint8_t t, bool allow_bound)
+    {
+        return (t & T_ANY) == T_NUM && (allow_bound || !(t & T_BOUND));
+    }
+
+    string type_name(uint8_t t)
+    {
+        if(!(t & T_ANY)) return "unreached";
+        if((t & T_ANY) == T_ANY) return "any";
+        static const char *const NAMES[] = {"nil", "boolean", "number", "string", "rule"};
+        string r;
+        for(int i = 0; i < 5; ++i)
+            if(t & (1 << i)) r += (r.empty() ? "" : "|") + string(NAMES[i]);
+        if(is_num(t, true) && (t & T_BOUND)) r += " (host result)";
+        return r;
+    }
+}
+
+void optimize_ssa(ByteFunc &f, ostream *types)
+{
+    SsaFunc s;
+    if(!build_ssa(f, s))
+    {
+        if(types) *types << "  (not analysed)\n";
+        return;
+    }
+    const vector<Op> code = f.code;
+    size_t n = code.size(), nb = s.blocks.size(), nv = s.values.size();
+    const vector<SsaValue> &vals = s.values;
+
+    // --- sparse conditional constant propagation ---
+    vector<Lattice> lat(nv);
+    vector<bool> exec(nb, false), fall_exec(nb, false), jump_exec(nb, false);
+    exec[0] = true;
+    vector<Lattice> host_fold(nv);
+    vector<bool> host_folded(nv, false);
+    auto edge_exec = [&](const SsaEdge &e)
+    {
+        return e.block < 0 || (e.jump ? jump_exec[e.block] : fall_exec[e.block]);
+    };
+    auto eval = [&](int v)
+    {
+        const SsaValue &val = vals[v];
+        Lattice r;
+        switch(val.kind)
+        {
+            case SsaValue::Const:
+                r.state = Lattice::Const;
+                r.k = (*f.consts)[code[val.ip].a];
+                return r;
+            case SsaValue::Read:
+            case SsaValue::Store:
+                return lat[val.args[0]];
+            case SsaValue::Phi:
+            {
+                const SsaBlock &blk = s.blocks[val.block];
+                for(size_t i = 0; i < val.args.size(); ++i)
+                    if(edge_exec(blk.preds[i])) meet(r, lat[val.args[i]]);
+                return r;
+            }
+            case SsaValue::Pure:
+            {
+                OpCode op = code[val.ip].op;
+                for(int a : val.args)
+                    if(lat[a].state != Lattice::Const) return lat[a];
+                if(host_call_op(op))
+                {
+                    // arguments only ever go from constant to Bottom, so
+                    // each call is run at most once
+                    if(!host_folded[v])
+                    {
+                        vector<Value> args;
+                        for(int a : val.args) args.push_back(lat[a].k);
+                        host_fold[v] = fold_host_call(f.host_calls[code[val.ip].b].name, args);
+                        host_folded[v] = true;
+                    }
+                    return host_fold[v];
+                }
+                r.state = Lattice::Const;
+                r.k = fold_op(op, lat[val.args[0]].k, val.args.size() > 1 ? lat[val.args[1]].k : Value());
+                return r;
+            }
+            default:
+                break;
+        }
+        r.state = Lattice::Bottom;
+        return r;
+    };
+    for(bool changed = true; changed; )
+    {
+        changed = false;
+        for(size_t v = 0; v < nv; ++v)
+        {
+            if(vals[v].block < 0 || !exec[vals[v].block]) continue;
+            Lattice x = eval((int)v);
+            if(x.state != lat[v].state || (x.state == Lattice::Const && !same_const(x.k, lat[v].k)))
+            {
+                lat[v] = x;
+                changed = true;
+            }
+        }
+        for(int b : s.rpo)
+        {
+            if(!exec[b]) continue;
+            const SsaBlock &blk = s.blocks[b];
+            int ip = blk.end - 1;
+            const Op &last = code[ip];
+            bool fall = !ends_flow(last.op), jump = is_jump_op(last.op);
+            if(last.op == OP_JMP_IF_FALSE || last.op == OP_JMP_IF_TRUE)
+            {
+                const Lattice &c = lat[s.operands[ip][0]];
+                if(c.state == Lattice::Top) fall = jump = false;
+                else if(c.state == Lattice::Const)
+                {
+                    jump = is_truthy(c.k) == (last.op == OP_JMP_IF_TRUE);
+                    fall = !jump;
+                }
+            }
+            for(const SsaEdge &e : blk.succs)
+            {
+                bool take = e.jump ? jump : fall;
+                vector<bool>::reference flag = e.jump ? jump_exec[b] : fall_exec[b];
+                if(!take || flag) continue;
+                flag = true;
+                exec[e.block] = true;
+                changed = true;
+            }
+        }
+    }
+
+    auto exec_ip = [&](int ip) { return exec[s.block_of[ip]]; };
+    // first ip of the tree computing what ip pushes, when the whole tree is
+    // straight-line code without effects (so it can go or be copied)
+    auto pure_tree = [&](int ip)
+    {
+        int start = s.tree_start[ip];
+        if(start < 0) return -1;
+        for(int i = start; i <= ip; ++i)
+        {
+            OpCode op = code[i].op;
+            if(op == OP_NOP || op == OP_PUSH_CONST || op == OP_PUSH_LOCAL || operator_op(op)) continue;
+            if(host_call_op(op) && vals[s.result[i]].kind == SsaValue::Pure) continue;
+            return -1;
+        }
+        return start;
+    };
+
+    // pushes turned into a constant, and branches that always go one way
+    // (1: falls through, 2: jumps)
+    vector<bool> konst(n, false);
+    vector<int> branch(n, 0);
+    for(size_t ip = 0; ip < n; ++ip)
+    {
+        if(!exec_ip((int)ip)) continue;
+        const Op &op = code[ip];
+        int v = s.result[ip];
+        if(v >= 0 && lat[v].state == Lattice::Const && op.op != OP_PUSH_CONST &&
+           (vals[v].kind == SsaValue::Read || vals[v].kind == SsaValue::Pure) && pure_tree((int)ip) >= 0)
+            konst[ip] = true;
+        if((op.op == OP_JMP_IF_FALSE || op.op == OP_JMP_IF_TRUE) && lat[s.operands[ip][0]].state == Lattice::Const)
+            branch[ip] = (is_truthy(lat[s.operands[ip][0]].k) == (op.op == OP_JMP_IF_TRUE)) ? 2 : 1;
+    }
+
+    // --- type inference: the tags each value may have ---
+    // flow-sensitive through the SSA versions of the locals, from the
+    // types of literals, operators, loop variables and host results
+    vector<HostSignature> sigs(f.host_calls.size());
+    vector<bool> has_sig(f.host_calls.size(), false);
+    for(size_t i = 0; i < f.host_calls.size(); ++i)
+        has_sig[i] = HostManifest::signature(f.host_calls[i].name, sigs[i]);
+    vector<uint8_t> ty(nv, 0);
+    auto infer = [&](int v) -> uint8_t
+    {
+        const SsaValue &val = vals[v];
+        if(lat[v].state == Lattice::Const) return type_of_const(lat[v].k);
+        switch(val.kind)
+        {
+            case SsaValue::Entry:
+                // params are whatever the caller passes, the rest start nil
+                return val.local < (int)f.nparams ? T_ANY : T_NIL;
+            case SsaValue::Read:
+            case SsaValue::Store:
+                return ty[val.args[0]];
+            case SsaValue::Phi:
+            {
+                const SsaBlock &blk = s.blocks[val.block];
+                uint8_t r = 0;
+                for(size_t i = 0; i < val.args.size(); ++i)
+                    if(edge_exec(blk.preds[i])) r |= ty[val.args[i]];
+                return r;
+            }
+            default:
+                break;
+        }
+        const Op &op = code[val.ip];
+        bool reached = all_of(val.args.begin(), val.args.end(), [&](int a) { return (ty[a] & T_ANY) != 0; });
+        switch(op.op)
+        {
+            case OP_ADD:
+            {
+                // numbers add up, anything else concatenates
+                uint8_t a = ty[val.args[0]], b = ty[val.args[1]], r = 0;
+                if(!reached) return 0;
+                if((a & T_NUM) && (b & T_NUM)) r |= T_NUM | ((a | b) & T_BOUND);
+                if((a | b) & T_ANY & ~T_NUM) r |= T_STR;
+                return r;
+            }
+            case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD: case OP_NEG:
+                return reached ? T_NUM : 0;
+            case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE: case OP_NOT:
+                return reached ? T_BOOL : 0;
+            case OP_CALL_HOST:
+            case OP_CALL_HOST_NUM:
+                return has_sig[op.b] && sigs[op.b].result == HostType::Number ? T_NUM | T_BOUND : T_ANY;
+            case OP_ITER_PREP:
+                // the sequence, and the index
+                return val.local == op.a ? ty[val.args[0]] : (uint8_t)T_NUM;
+            case OP_ITER_NEXT:
+                return val.local < 0 ? T_STR : T_NUM;
+            case OP_FORPREP:
+            case OP_FORLOOP:
+                // stored only once they are known to be numbers
+                return T_NUM;
+            default:
+                return T_ANY;
+        }
+    };
+    for(bool changed = true; changed; )
+    {
+        changed = false;
+        for(size_t v = 0; v < nv; ++v)
+        {
+            if(vals[v].block < 0 || !exec[vals[v].block]) continue;
+            uint8_t t = ty[v] | infer((int)v);
+            if(t != ty[v])
+            {
+                ty[v] = t;
+                changed = true;
+            }
+        }
+    }
+    auto numbers = [&](int ip, bool allow_bound)
+    {
+        return all_of(s.operands[ip].begin(), s.operands[ip].end(), [&](int v) { return is_num(ty[v], allow_bound); });
+    };
+    auto numeric_site = [&](const Op &op)
+    {
+        return has_sig[op.b] && sigs[op.b].all_numeric() && sigs[op.b].argc == op.a;
+    };
+    // ip as emitted: operators on proven numbers are marked for the JIT and
+    // AOT, and host calls whose args are proven numbers take the unboxed
+    // entry, checking the tags only where the proof rests on a host result
+    auto typed = [&](int ip)
+    {
+        Op op = code[ip];
+        if(op.op >= OP_ADD && op.op <= OP_NE && numbers(ip, false)) op.c = 1;
+        else if(host_call_op(op.op) && numeric_site(op) && numbers(ip, true))
+        {
+            op.op = OP_CALL_HOST_NUM;
+            op.c = !numbers(ip, false);
+        }
+        return op;
+    };
+
+    // --- dead code elimination: mark what effects and kept values need ---
+    auto effectful = [&](size_t ip)
+    {
+        OpCode op = code[ip].op;
+        switch(op)
+        {
+            case OP_NOP: case OP_PUSH_CONST: case OP_PUSH_LOCAL: case OP_STORE_LOCAL: case OP_POP:
+                return false;
+            case OP_CALL_HOST:
+            case OP_CALL_HOST_NUM:
+                return vals[s.result[ip]].kind != SsaValue::Pure;
+            default:
+                return !operator_op(op);
+        }
+    };
+    vector<bool> needed(n, false), live(nv, false);
+    vector<int> ip_work, value_work;
+    auto need = [&](int ip)
+    {
+        if(!needed[ip]) { needed[ip] = true; ip_work.push_back(ip); }
+    };
+    auto use = [&](int v)
+    {
+        if(!live[v]) { live[v] = true; value_work.push_back(v); }
+    };
+    for(size_t ip = 0; ip < n; ++ip)
+        if(exec_ip((int)ip) && effectful(ip)) need((int)ip);
+    // what a block inherits on the stack stays there
+    for(int b : s.rpo)
+        if(exec[b])
+            for(int v : s.blocks[b].entry_stack)
+                if(vals[v].kind == SsaValue::Phi) use(v);
+    while(!ip_work.empty() || !value_work.empty())
+    {
+        if(!ip_work.empty())
+        {
+            int ip = ip_work.back();
+            ip_work.pop_back();
+            if(konst[ip] || branch[ip]) continue;
+            for(int v : s.operands[ip]) use(v);
+            if(code[ip].op == OP_PUSH_LOCAL) use(vals[s.result[ip]].args[0]);
+            for(int v : s.local_reads[ip]) use(v);
+            continue;
+        }
+        int v = value_work.back();
+        value_work.pop_back();
+        const SsaValue &val = vals[v];
+        switch(val.kind)
+        {
+            case SsaValue::Phi:
+            {
+                const SsaBlock &blk = s.blocks[val.block];
+                for(size_t i = 0; i < val.args.size(); ++i)
+                    if(edge_exec(blk.preds[i])) use(val.args[i]);
+                break;
+            }
+            case SsaValue::Store:
+                need(val.ip);
+                break;
+            case SsaValue::Entry:
+                break;
+            default:
+                // a pushed value; the locals effects write belong to
+                // instructions that are kept anyway
+                if(val.ip >= 0 && s.result[val.ip] == v) need(val.ip);
+                break;
+        }
+    }
+
+    // what each instruction becomes; the code of blocks that never run
+    // goes away
+    vector<vector<Op>> body(n);
+    auto pushed = [&](int v)
+    {
+        return vals[v].kind == SsaValue::Phi || (vals[v].ip >= 0 && needed[vals[v].ip]);
+    };
+    auto pop_kept = [&](vector<Op> &out, const vector<int> &operands)
+    {
+        int m = (int)count_if(operands.begin(), operands.end(), pushed);
+        if(m) out.push_back(Op(OP_POP, m));
+    };
+    for(size_t ip = 0; ip < n; ++ip)
+    {
+        if(!exec_ip((int)ip)) continue;
+        const Op &op = code[ip];
+        if(branch[ip])
+        {
+            pop_kept(body[ip], s.operands[ip]);
+            if(branch[ip] == 2) body[ip].push_back(Op(OP_JMP, op.a));
+        }
+        else if(needed[ip] && konst[ip])
+        {
+            // only the constants that are kept go into the pool; folded
+            // strings are interned like literals, so equal ones share an entry
+            const Value &k = lat[s.result[ip]].k;
+            body[ip] = {Op(OP_PUSH_CONST, f.consts->add(k.is_string() ? Value::make_interned(k.str()) : k))};
+        }
+        else if(needed[ip]) body[ip] = {typed((int)ip)};
+        else pop_kept(body[ip], s.operands[ip]);
+    }
+
+    if(types)
+    {
+        // what each local holds where it is read, then the operators and
+        // numeric host calls left generic, with what their operands may be
+        vector<uint8_t> read(f.locals.size(), 0);
+        vector<bool> was_read(f.locals.size(), false);
+        for(size_t ip = 0; ip < n; ++ip)
+            if(exec_ip((int)ip) && code[ip].op == OP_PUSH_LOCAL)
+            {
+                read[code[ip].a] |= ty[s.result[ip]];
+                was_read[code[ip].a] = true;
+            }
+        // the script's names for a slot, without the hidden locals it held
+        auto slot_name = [&](int l)
+        {
+            string names, all = f.locals[l] + "|";
+            for(size_t at = 0, bar; (bar = all.find('|', at)) != string::npos; at = bar + 1)
+                if(bar > at && all[at] != '(') names += (names.empty() ? "" : "|") + all.substr(at, bar - at);
+            return names;
+        };
+        for(size_t l = 0; l < f.locals.size(); ++l)
+        {
+            string name = slot_name((int)l);
+            if(name.empty()) continue;
+            *types << "  " << (l < f.nparams ? "param " : "local ") << name << ": "
+                   << (was_read[l] ? type_name(read[l]) : string("never read")) << "\n";
+        }
+        auto operand = [&](int v)
+        {
+            string t = type_name(ty[v]);
+            if(vals[v].kind != SsaValue::Read) return t;
+            string name = slot_name(code[vals[v].ip].a);
+            return name.empty() ? t : name + " (" + t + ")";
+        };
+        static const char *const SYMBOLS[] = {"+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!="};
+        size_t ops = 0, typed_ops = 0, calls = 0, typed_calls = 0;
+        vector<string> generic;
+        for(size_t ip = 0; ip < n; ++ip)
+        {
+            if(!exec_ip((int)ip) || !needed[ip] || konst[ip]) continue;
+            Op op = typed((int)ip);
+            const vector<int> &args = s.operands[ip];
+            if(op.op >= OP_ADD && op.op <= OP_NE)
+            {
+                ++ops;
+                if(op.c) ++typed_ops;
+                else generic.push_back(operand(args[0]) + " " + SYMBOLS[op.op - OP_ADD] + " " + operand(args[1]));
+            }
+            else if(host_call_op(op.op) && numeric_site(op))
+            {
+                ++calls;
+                if(op.op == OP_CALL_HOST_NUM) ++typed_calls;
+                else
+                {
+                    string call = f.host_calls[op.b].name + "(";
+                    for(size_t i = 0; i < args.size(); ++i) call += (i ? ", " : "") + operand(args[i]);
+                    generic.push_back(call + ")");
+                }
+            }
+        }
+        *types << "  operators on numbers: " << typed_ops << " of " << ops
+               << ", unboxed host calls: " << typed_calls << " of " << calls << "\n";
+        for(const string &g : generic) *types << "  generic: " << g << "\n";
+    }
+
+    // --- common subexpression elimination of pure host calls ---
+    // value numbers over the dominator tree: equal numbers, equal values
+    auto candidate = [&](int ip)
+    {
+        return ip >= 0 && host_call_op(code[ip].op) && needed[ip] && !konst[ip] &&
+               vals[s.result[ip]].kind == SsaValue::Pure;
+    };
+    vector<int> vn(nv, -1), rep_of(n, -1);
+    vector<vector<int>> block_values(nb), children(nb);
+    for(size_t v = 0; v < nv; ++v)
+        if(vals[v].block >= 0 && exec[vals[v].block]) block_values[vals[v].block].push_back((int)v);
+    for(int b : s.rpo)
+        if(b != 0 && exec[b]) children[s.blocks[b].idom].push_back(b);
+    unordered_map<string,int> table;
+    vector<pair<string,int>> undo;      // key, the entry it shadowed (-1: none)
+    auto const_key = [](const Value &k)
+    {
+        return k.is_string() ? "s" + k.str() : "k" + to_string(k.raw_bits());
+    };
+    function<void(int)> number_block = [&](int b)
+    {
+        size_t mark = undo.size();
+        for(int v : block_values[b])
+        {
+            const SsaValue &val = vals[v];
+            string key;
+            switch(val.kind)
+            {
+                case SsaValue::Const:
+                    key = const_key((*f.consts)[code[val.ip].a]);
+                    break;
+                case SsaValue::Read:
+                    if(konst[val.ip]) key = const_key(lat[v].k);
+                    else vn[v] = vn[val.args[0]];
+                    break;
+                case SsaValue::Store:
+                    vn[v] = vn[val.args[0]];
+                    break;
+                case SsaValue::Pure:
+                {
+                    if(konst[val.ip]) { key = const_key(lat[v].k); break; }
+                    const Op &op = code[val.ip];
+                    key = host_call_op(op.op) ? "call " + to_string(op.b) : string(opcode_name(op.op));
+                    for(int a : val.args) key += " " + to_string(vn[a]);
+                    break;
+                }
+                default:
+                    vn[v] = v;
+                    break;
+            }
+            if(key.empty()) continue;
+            auto it = table.find(key);
+            if(it != table.end())
+            {
+                vn[v] = vn[it->second];
+                if(val.kind == SsaValue::Pure && candidate(val.ip) && candidate(vals[it->second].ip))
+                    rep_of[val.ip] = vals[it->second].ip;
+                continue;
+            }
+            // only a call that is still made can stand in for later ones
+            if(val.kind == SsaValue::Pure && host_call_op(code[val.ip].op) && !candidate(val.ip))
+            {
+                vn[v] = v;
+                continue;
+            }
+            vn[v] = v;
+            undo.push_back({key, -1});
+            table.emplace(key, v);
+        }
+        for(int c : children[b]) number_block(c);
+        while(undo.size() > mark)
+        {
+            table.erase(undo.back().first);
+            undo.pop_back();
+        }
+    };
+    number_block(0);
+
+    // a call equal to one that dominates it reads that one's result from a
+    // hidden local instead; its whole argument tree goes with it. Outer
+    // calls first, so the calls inside a replaced tree need no local.
+    vector<int> temp_of(n, -1), start_of(n, -1);
+    vector<bool> covered(n, false), member(n, false);
+    auto temp = [&](int ip)
+    {
+        if(temp_of[ip] < 0)
+        {
+            temp_of[ip] = (int)f.locals.size();
+            f.locals.push_back("(" + f.host_calls[code[ip].b].name + " result)");
+        }
+        return temp_of[ip];
+    };
+    vector<bool> rep_used(n, false);
+    for(size_t ip = n; ip-- > 0; )
+    {
+        if(rep_of[ip] < 0 || covered[ip]) continue;
+        int start = pure_tree((int)ip);
+        if(start < 0) continue;
+        for(int i = start; i <= (int)ip; ++i) covered[i] = true;
+        start_of[ip] = start;
+        member[ip] = true;
+        rep_used[rep_of[ip]] = true;
+    }
+    // a rep is never inside a replaced tree: the calls in there have equal
+    // ones dominating them, in the rep's own arguments. Should that ever
+    // fail, no call is merged rather than one reading a local never stored.
+    bool sound = true;
+    for(size_t ip = 0; ip < n; ++ip) sound = sound && !(rep_used[ip] && covered[ip]);
+    if(!sound)
+    {
+        dbg("SSA: common calls left unmerged");
+        fill(covered.begin(), covered.end(), false);
+        fill(member.begin(), member.end(), false);
+        fill(rep_used.begin(), rep_used.end(), false);
+    }
+    for(size_t ip = 0; ip < n; ++ip)
+    {
+        if(!member[ip]) continue;
+        for(int i = start_of[ip]; i <= (int)ip; ++i) body[i].clear();
+        body[ip] = {Op(OP_PUSH_LOCAL, temp(rep_of[ip]))};
+    }
+    for(size_t ip = 0; ip < n; ++ip)
+        if(rep_used[ip])
+            body[ip] = {typed((int)ip), Op(OP_STORE_LOCAL, temp(ip)), Op(OP_PUSH_LOCAL, temp(ip))};
+
+    // --- loop-invariant code motion of pure host calls ---
+    struct Loop
+    {
+        int header;
+        vector<bool> blocks;
+        size_t size = 0;
+        vector<int> exits;      // blocks that leave the loop, by an edge or RET
+    };
+    vector<Loop> loops;
+    for(int b : s.rpo)
+    {
+        if(!exec[b]) continue;
+        for(const SsaEdge &e : s.blocks[b].succs)
+        {
+            if(!(e.jump ? jump_exec[b] : fall_exec[b]) || !s.dominates(e.block, b)) continue;
+            // a back edge: the loop is every block that reaches b without
+            // passing the header
+            auto it = find_if(loops.begin(), loops.end(), [&](const Loop &l) { return l.header == e.block; });
+            if(it == loops.end())
+            {
+                loops.push_back(Loop{e.block, vector<bool>(nb, false), 0, {}});
+                it = loops.end() - 1;
+                it->blocks[e.block] = true;
+            }
+            vector<int> work{b};
+            while(!work.empty())
+            {
+                int x = work.back();
+                work.pop_back();
+                if(it->blocks[x]) continue;
+                it->blocks[x] = true;
+                for(const SsaEdge &p : s.blocks[x].preds)
+                    if(p.block >= 0 && exec[p.block]) work.push_back(p.block);
+            }
+        }
+    }
+    for(Loop &l : loops)
+    {
+        l.size = count(l.blocks.begin(), l.blocks.end(), true);
+        for(int x = 0; x < (int)nb; ++x)
+        {
+            if(!l.blocks[x]) continue;
+            bool leaves = s.blocks[x].succs.empty();
+            for(const SsaEdge &e : s.blocks[x].succs)
+                leaves = leaves || ((e.jump ? jump_exec[x] : fall_exec[x]) && !l.blocks[e.block]);
+            if(leaves) l.exits.push_back(x);
+        }
+    }
+    // outermost first
+    sort(loops.begin(), loops.end(), [](const Loop &a, const Loop &b) { return a.size > b.size; });
+
+    // A call is only hoisted when its block dominates every exit of the
+    // loop: then each trip that ends makes it, and hoisting it runs it once
+    // instead. Calls under a branch inside the loop, or only reached once
+    // the loop test passed, would run before the loop even when the branch
+    // is never taken or the loop makes no trip; only Cheap ones are worth
+    // that speculation (HostSignature::cost).
+    auto every_trip = [&](int b, const Loop &l)
+    {
+        for(int x : l.exits)
+            if(!s.dominates(b, x)) return false;
+        return true;
+    };
+    auto cheap = [&](int ip)
+    {
+        int site = code[ip].b;
+        return has_sig[site] && sigs[site].cost == HostCost::Cheap;
+    };
+
+    // the code hoisted in front of each loop header, entered by falling
+    // into the header and by jumps from outside the loop
+    vector<vector<pair<int, vector<Op>>>> pre(n);
+    vector<const Loop*> pre_loop(n, nullptr);
+    auto version_block = [&](int v) { return vals[v].kind == SsaValue::Entry ? -1 : vals[v].block; };
+    auto invariant = [&](int start, int ip, const Loop &l)
+    {
+        for(int i = start; i <= ip; ++i)
+        {
+            if(body[i].empty()) continue;
+            if(code[i].op != OP_PUSH_LOCAL || konst[i]) continue;
+            int b = version_block(vals[s.result[i]].args[0]);
+            if(b >= 0 && l.blocks[b]) return false;
+        }
+        return true;
+    };
+    for(size_t ip = n; ip-- > 0; )
+    {
+        if(!candidate((int)ip) || member[ip] || covered[ip]) continue;
+        int start = pure_tree((int)ip);
+        if(start < 0) continue;
+        bool clean = true;
+        for(int i = start; i < (int)ip; ++i) clean = clean && !covered[i];
+        if(!clean) continue;
+        int b = s.block_of[ip];
+        for(const Loop &l : loops)
+        {
+            int h = s.blocks[l.header].begin;
+            if(!l.blocks[b] || (h > 0 && l.blocks[s.block_of[h - 1]]) || !invariant(start, (int)ip, l)) continue;
+            if(!every_trip(b, l) && !cheap((int)ip)) continue;
+            int t = temp((int)ip);
+            vector<Op> hoisted;
+            for(int i = start; i < (int)ip; ++i)
+            {
+                hoisted.insert(hoisted.end(), body[i].begin(), body[i].end());
+                body[i].clear();
+                covered[i] = true;
+            }
+            hoisted.push_back(typed((int)ip));
+            hoisted.push_back(Op(OP_STORE_LOCAL, t));
+            body[ip] = {Op(OP_PUSH_LOCAL, t)};
+            covered[ip] = true;
+            pre[h].push_back({(int)ip, move(hoisted)});
+            pre_loop[h] = &l;
+            break;
+        }
+    }
+
+    // --- back to stack code ---
+    vector<Op> out;
+    vector<int> src;                // the ip each emitted op came from
+    vector<int> head(n + 1), self(n + 1);
+    for(size_t ip = 0; ip < n; ++ip)
+    {
+        head[ip] = (int)out.size();
+        sort(pre[ip].begin(), pre[ip].end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        for(auto &p : pre[ip])
+            for(const Op &op : p.second)
+            {
+                out.push_back(op);
+                src.push_back(-1);
+            }
+        self[ip] = (int)out.size();
+        for(const Op &op : body[ip])
+        {
+            out.push_back(op);
+            src.push_back((int)ip);
+        }
+    }
+    head[n] = self[n] = (int)out.size();
+    for(size_t k = 0; k < out.size(); ++k)
+    {
+        Op &op = out[k];
+        if(!is_jump_op(op.op)) continue;
+        int t = op.a;
+        const Loop *l = pre_loop[t];
+        bool from_outside = l && !l->blocks[s.block_of[src[k]]];
+        op.a = from_outside ? head[t] : self[t];
+    }
+    f.code = move(out);
+}
@@ -0,0 +1,94 @@
+#ifndef MONDOT_SSA_H
+#define MONDOT_SSA_H
+
+#include "bytecode.h"
+#include <vector>
+#include <iosfwd>
+
+// Mid-level IR: the SSA form of a handler, lifted from the naive stack
+// code compile_unit emits before any other pass runs. Every push becomes a
+// value, every store a new version of its local, and the locals (and
+// operand stack slots) that differ between the predecessors of a block
+// meet in phis. Lifting from the stack code rather than the AST keeps
+// scoping, short-circuiting and loop lowering in one place, and since
+// every value remembers the instruction that pushed it, passes over the IR
+// rewrite the stack code directly instead of re-emitting it.
+
+struct SsaValue
+{
+    enum Kind : uint8_t
+    {
+        Entry,      // a local on entry to the handler
+        Const,      // PUSH_CONST
+        Read,       // PUSH_LOCAL: args = {the version it reads}
+        Pure,       // ADD..NE, NOT, NEG or a call of a pure host function
+        Effect,     // anything else: calls, ITER_NEXT's char, and the
+                    // locals ITER_PREP, ITER_NEXT, FORPREP, FORLOOP write
+        Store,      // version a STORE_LOCAL gives its local: args = {value}
+        Phi         // args: one per entry of its block's preds
+    };
+    Kind kind;
+    int block = -1;
+    int ip = -1;            // defining instruction, -1 for Entry and Phi
+    int local = -1;         // the local a version belongs to, -1 for stack values
+    std::vector<int> args;
+};
+
+struct SsaEdge
+{
+    int block;              // -1: the handler entry
+    bool jump;              // taken jump rather than fall-through
+};
+
+struct SsaBlock
+{
+    int begin = 0, end = 0;             // ip range [begin, end)
+    std::vector<SsaEdge> preds, succs;  // reachable ones only
+    int idom = -1;
+    std::vector<int> phis;
+    std::vector<int> entry_stack;       // operand stack on entry, bottom first
+};
+
+struct SsaFunc
+{
+    std::vector<SsaBlock> blocks;
+    std::vector<SsaValue> values;
+    std::vector<int> rpo;               // reachable blocks in reverse postorder
+    std::vector<int> block_of;          // per ip
+    std::vector<int> result;            // per ip: the value it pushes, or -1
+    std::vector<std::vector<int>> operands;     // per ip: values it pops, deepest first
+    std::vector<std::vector<int>> local_reads;  // per ip: versions ITER_NEXT / FORLOOP read
+    // per ip that pushes: first ip of the straight-line code computing that
+    // value (its expression tree), -1 when part of it comes from another block
+    std::vector<int> tree_start;
+
+    bool dominates(int a, int b) const;
+};
+
+// false when f holds instructions the naive code never does
+// (superinstructions, quickened ops), which the lifter does not model
+bool build_ssa(const ByteFunc &f, SsaFunc &out);
+
+// The -O2 mid-level pass, run on the naive code before optimize_jumps:
+//  - sparse conditional constant propagation through locals and branches,
+//    folding operators the way the VM computes them, and pure host calls
+//    by running them (see HostManifest::fold_slot); branches it decides
+//    become jumps (or nothing) and the code they skip goes away
+//  - dead code elimination: stores nothing reads, and pure computations
+//    whose result is unused
+//  - common subexpression elimination of pure host calls: a call equal to
+//    one that dominates it reads that one's result from a hidden local
+//  - loop-invariant code motion of pure host calls whose arguments do not
+//    change in a while / foreach / for loop: computed once before it, if
+//    every trip through the loop makes the call or the call is Cheap
+//  - type inference: the tags every value may have, flow-sensitive
+//    through the versions of each local. Operators whose operands are
+//    proven numbers are marked for the JIT and AOT (Op::c), and calls of
+//    numeric host bindings with proven number args take the unboxed entry
+// Calls are pure as published by HostSignature::pure when the unit is
+// compiled. With types set, what inference found is described there
+// (--types): the type of each local where it is read, and the operators
+// and numeric host calls left generic.
+void optimize_ssa(ByteFunc &f, std::ostream *types = nullptr);
+
+#endif
@@ -0,0 +1,146 @@
+#include "verifier.h"
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+// operands an instruction pops before it pushes anything (its stack_effect
+// is what it leaves behind)
+static int stack_inputs(const Op &op)
+{
+    switch(op.op)
+    {
+        case OP_STORE_LOCAL:
+        case OP_JMP_IF_FALSE:
+        case OP_JMP_IF_TRUE:
+        case OP_ITER_PREP:
+        case OP_NOT:
+        case OP_NEG:
+            return 1;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+            return 2;
+        case OP_CALL:
+        case OP_CALL_HOST:
+        case OP_CALL_HOST_NUM:
+        case OP_CALL_HOST_POP:
+        case OP_POP:
+            return op.a;
+        case OP_CALL_DYNAMIC:
+            return op.a + 1;
+        case OP_FORPREP:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+void verify_function(const ByteModule &m, ByteFunc &f, const string &name)
+{
+    const vector<Op> &code = f.code;
+    size_t ip = 0;
+    auto fail = [&](const string &why)
+    {
+        string where = ip < code.size() ? string(" (") + opcode_name(code[ip].op) + ")" : string();
+        throw runtime_error("handler '" + name + "' in unit '" + m.name + "' failed verification at ip " +
+                            to_string(ip) + where + ": " + why);
+    };
+
+    if(code.empty()) fail("no code");
+    size_t nconsts = f.consts ? f.consts->size() : 0;
+    auto local = [&](int i) { if(i < 0 || (size_t)i >= f.locals.size()) fail("local " + to_string(i) + " out of range"); };
+    auto constant = [&](int i) { if(i < 0 || (size_t)i >= nconsts) fail("constant " + to_string(i) + " out of range"); };
+    auto target = [&](int t) { if(t < 0 || (size_t)t >= code.size()) fail("jump target " + to_string(t) + " outside the function"); };
+
+    // operands, independent of the path taken
+    for(ip = 0; ip < code.size(); ++ip)
+    {
+        const Op &op = code[ip];
+        if(op.op >= OP_COUNT) fail("unknown opcode " + to_string((int)op.op));
+        if(generic_opcode(op.op) != op.op) fail("quickened opcode in compiled code");
+        if(is_jump_op(op.op)) target(op.a);
+        switch(op.op)
+        {
+            case OP_PUSH_CONST:
+            case OP_RET_CONST:
+                constant(op.a);
+                break;
+            case OP_PUSH_LOCAL:
+            case OP_PUSH_LOCAL_MOVE:
+            case OP_STORE_LOCAL:
+                local(op.a);
+                break;
+            case OP_PUSH_LOCAL2:
+            case OP_MOVE_LOCAL:
+                local(op.a);
+                local(op.b);
+                break;
+            case OP_ITER_PREP:
+                local(op.a);
+                local(op.a + 1);
+                break;
+            case OP_ITER_NEXT:
+                local(op.b);
+                local(op.b + 1);
+                break;
+            case OP_FORPREP:
+            case OP_FORLOOP:
+                local(op.b);
+                local(op.b + 3);
+                break;
+            case OP_STORE_CONST:
+            case OP_INC_LOCAL:
+                local(op.a);
+                constant(op.b);
+                break;
+            case OP_TEST_LT_LK: case OP_TEST_LE_LK: case OP_TEST_GT_LK:
+            case OP_TEST_GE_LK: case OP_TEST_EQ_LK: case OP_TEST_NE_LK:
+                local(op.b);
+                constant(op.c);
+                break;
+            case OP_CALL:
+                if(op.b >= m.funcs.size()) fail("call to unknown function " + to_string(op.b));
+                break;
+            case OP_CALL_HOST:
+            case OP_CALL_HOST_NUM:
+            case OP_CALL_HOST_POP:
+                if(op.b >= f.host_calls.size()) fail("host call site " + to_string(op.b) + " out of range");
+                break;
+            default:
+                break;
+        }
+        if(stack_inputs(op) < 0) fail("negative operand count");
+    }
+
+    // stack depth along every path
+    vector<int> depth(code.size(), -1);
+    vector<size_t> work{0};
+    depth[0] = 0;
+    int max_depth = 0;
+    while(!work.empty())
+    {
+        ip = work.back();
+        work.pop_back();
+        const Op &op = code[ip];
+        if(depth[ip] < stack_inputs(op))
+            fail("needs " + to_string(stack_inputs(op)) + " operands, stack has " + to_string(depth[ip]));
+        int next = depth[ip] + stack_effect(op);
+
+        auto flow = [&](size_t to, int next)
+        {
+            if(to >= code.size()) fail("runs off the end of the function");
+            if(depth[to] < 0)
+            {
+                max_depth = max(max_depth, next);
+                depth[to] = next;
+                work.push_back(to);
+            }
+            else if(depth[to] != next)
+                fail("stack depth " + to_string(next) + " at ip " + to_string(to) + " where another path has " +
+                     to_string(depth[to]));
+        };
+        if(is_jump_op(op.op)) flow((size_t)op.a, depth[ip] + branch_stack_effect(op));
+        if(op.op != OP_JMP && op.op != OP_RET && op.op != OP_RET_CONST) flow(ip + 1, next);
+    }
+    f.max_stack = (uint32_t)max_depth;
+}
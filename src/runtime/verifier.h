@@ -0,0 +1,24 @@
+#ifndef MONDOT_VERIFIER_H
+#define MONDOT_VERIFIER_H
+
+#include "bytecode.h"
+#include <string>
+
+// Load-time bytecode verifier, run by compile_unit on every function once
+// the whole module has been emitted and optimized. It proves what the
+// interpreter's handlers used to re-check on every instruction:
+//   - every opcode is one the compiler emits (no quickened forms)
+//   - const, local, host call site and CALL target operands are in range,
+//     and counts are not negative
+//   - every jump lands inside the function and no path runs off its end
+//   - every instruction finds enough operands on the stack, and all paths
+//     reaching an ip agree on the stack depth there
+// and fills ByteFunc::max_stack with the deepest operand stack reached, so
+// push_frame can reserve exactly that much.
+//
+// A function that fails is rejected with a runtime_error naming the
+// handler, the ip and the reason. CALL_DYNAMIC's callee is a runtime
+// value and stays checked by the VM.
+void verify_function(const ByteModule &m, ByteFunc &f, const std::string &name);
+
+#endif
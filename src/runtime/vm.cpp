@@ -1,6 +1,9 @@
 #include "vm.h"
+#include "vm_ops.h"
+#include "aot.h"
 #include "util.h"
-#include <optional>
+#include <stdexcept>
+#include <cmath>
 
 using namespace std;
 
@@ -17,28 +20,50 @@ struct ActiveCallGuard
     }
 };
 
-static inline bool is_truthy(const Value &v)
+#if defined(__GNUC__) || defined(__clang__)
+  #define VM_COLD __attribute__((noinline, cold))
+#elif defined(_MSC_VER)
+  #define VM_COLD __declspec(noinline)
+#else
+  #define VM_COLD
+#endif
+
+// Kept out of line so the rewrite bookkeeping does not compete with the
+// dispatch loop's cached registers. The code of a function is only ever
+// rewritten by the VM running it.
+VM_COLD
+static void quicken(ByteFunc &f, const Op *pc, OpCode quick)
 {
-    if(v.tag == Tag::Nil) return false;
-    if(v.tag == Tag::Boolean) return v.boolean;
-    if(v.tag == Tag::Number) return v.num != 0.0;
-    return true;
+    size_t ip = (size_t)(pc - f.code.data());
+    if(f.deopts[ip] < QUICKEN_LIMIT) f.code[ip].op = quick;
 }
 
-static inline bool valid_const(const ByteFunc &f, int i)
+VM_COLD
+static void dequicken(ByteFunc &f, const Op *pc)
 {
-    return i >= 0 && (size_t)i < f.consts.size();
+    size_t ip = (size_t)(pc - f.code.data());
+    f.code[ip].op = generic_opcode(f.code[ip].op);
+    ++f.deopts[ip];
 }
 
-static inline bool valid_local(const Frame &fr, int i)
+// quickened form of a compare (LT..NE) that just saw two numbers: the
+// compare-and-branch one when a JMP_IF_FALSE consumes its result
+static inline OpCode quickened_compare(const Op *pc)
 {
-    return i >= 0 && (size_t)i < fr.locals.size();
+    int k = pc->op - OP_LT;
+    return (OpCode)((pc[1].op == OP_JMP_IF_FALSE ? OP_JLT_NN : OP_LT_NN) + k);
 }
 
 VM::VM(HostBridge &h): host(h)
 {
-    eval_stack.reserve(1024);
-    arg_scratch.reserve(64);
+    stack.resize(INITIAL_STACK_SLOTS);
+    top = stack.data();
+    frames.reserve(256);
+}
+
+void VM::set_max_call_depth(size_t depth)
+{
+    max_call_depth = depth;
 }
 
 Value VM::execute_handler(Module *m, const string &name)
@@ -52,7 +77,6 @@ Value VM::execute_handler(Module *m, const string &name)
         return Value::make_nil();
     }
 
-    ActiveCallGuard guard(m);
     return execute_handler_idx(m, it->second);
 }
 
@@ -62,163 +86,610 @@ Value VM::execute_handler_idx(Module *m, int idx)
     if(idx < 0 || idx >= (int)m->bytecode.funcs.size())
         return Value::make_nil();
 
+    // frames only ever call into their own module, so one guard covers
+    // the whole activation
+    ActiveCallGuard guard(m);
     ByteFunc &f = m->bytecode.funcs[idx];
+    ensure_compiled(m->bytecode, f, host);
+    if(f.native)
+    {
+        AotContext cx{&host, frames.size(), max_call_depth};
+        return f.native(cx, nullptr, 0);
+    }
 
-    Frame fr;
-    fr.module = m;
-    fr.func   = &f;
-    fr.locals.assign(f.locals.size(), Value::make_nil());
+    size_t depth = frames.size();
+    size_t entry_used = (size_t)(top - stack.data());
+    try
+    {
+        push_frame(m, f, 0, nullptr);
+        return run(depth);
+    }
+    catch(...)
+    {
+        unwind(depth, entry_used);
+        throw;
+    }
+}
 
-    return run_frame(fr);
+// makes room for 'slots' values above top. Frames refer to the stack by
+// offset, so growing it only invalidates the pointers cached inside run(),
+// which reloads them after every call.
+void VM::reserve_stack(size_t slots)
+{
+    size_t used = (size_t)(top - stack.data());
+    if(used + slots <= stack.size()) return;
+    stack.resize(max(stack.size() * 2, used + slots));
+    top = stack.data() + used;
 }
 
-Value VM::call_bytecode_function(Module *m, int idx, const vector<Value> &args)
+// the nargs values just below top become the first locals of f
+void VM::push_frame(Module *m, ByteFunc &f, int nargs, const Op *ret_pc)
 {
-    if(!m) return Value::make_nil();
-    if(idx < 0 || idx >= (int)m->bytecode.funcs.size())
-        return Value::make_nil();
+    if(frames.size() >= max_call_depth)
+        throw runtime_error("call depth limit of " + to_string(max_call_depth) + " exceeded");
 
-    ByteFunc &f = m->bytecode.funcs[idx];
+    size_t window = f.locals.size() + f.max_stack;
+    if(window > (size_t)nargs) reserve_stack(window - (size_t)nargs);
 
-    Frame fr;
-    fr.module = m;
-    fr.func   = &f;
-    fr.locals.assign(f.locals.size(), Value::make_nil());
+    Value *args = top - nargs;
+    // args past the params are dropped; missing params and the remaining
+    // locals are already nil
+    for(int i = (int)f.nparams; i < nargs; ++i) args[i] = Value();
 
-    for(size_t i=0;i<args.size() && i<fr.locals.size();++i)
-        fr.locals[i] = args[i];
+    frames.push_back(Frame{m, &f, ret_pc, (size_t)(args - stack.data())});
+    top = args + f.locals.size();
+}
 
-    return run_frame(fr);
+// counts one call or back edge of f and says whether f has jitted code to
+// run, translating it when it has just become hot enough
+bool VM::jit_ready(ByteFunc &f, uint32_t threshold)
+{
+    if(f.jit) return true;
+    if(jit_mode == JitMode::Hot && ++f.hotness < threshold) return false;
+    return jit_compile(f) != nullptr;
 }
 
-Value VM::run_frame(Frame &fr)
+// runs f's jitted code on the current frame from ip (0 or a loop header)
+// to its return; top is the frame's sp on the way in and out
+Value VM::enter_jit(ByteFunc &f, Value *locals, uint32_t ip)
 {
-    ActiveCallGuard guard(fr.module);
-    ByteFunc &f = *fr.func;
-    size_t base_sp = eval_stack.size();
+    JitFrame jf;
+    jf.locals = locals;
+    jf.sp = top;
+    jf.top = &top;
+    jf.func = &f;
+    jf.host = &host;
+    jf.entry_ip = ip;
+    f.jit->entry(&jf);
+    top = jf.sp;
+    if(jf.error) rethrow_exception(jf.error);
+    return move(jf.ret);
+}
 
-    for(size_t ip = 0; ip < f.code.size(); ++ip)
+// after an exception: drops the frames above depth and clears everything
+// they left on the stack
+void VM::unwind(size_t depth, size_t entry_used)
+{
+    frames.resize(depth);
+    for(size_t i = entry_used; i < stack.size(); ++i) stack[i] = Value();
+    top = stack.data() + entry_used;
+}
+
+// Dispatch: with MONDOT_COMPUTED_GOTO each handler jumps straight to the
+// next one through a table of label addresses (direct threading), giving
+// every opcode its own indirect branch for the predictor to learn. The
+// portable fallback is a switch in a loop. Handlers are written once
+// against the VM_CASE / VM_NEXT / VM_JUMP macros and compile either way.
+//
+// Handlers check nothing that verify_function (verifier.h) has proven for
+// every function compile_unit produces: operand indices, jump targets, the
+// code never running off its end, and enough operands on the stack for
+// every pop. Pushes need no capacity check either: push_frame reserves the
+// verified max_stack operand slots for every frame.
+#if MONDOT_COMPUTED_GOTO && (defined(__GNUC__) || defined(__clang__))
+  #define MONDOT_THREADED 1
+#else
+  #define MONDOT_THREADED 0
+#endif
+
+#if MONDOT_THREADED
+  #define VM_CASE(name)   L_##name:
+  #define VM_DEFAULT      L_UNKNOWN: __attribute__((unused));
+  #define VM_DISPATCH()   goto *dispatch_table[pc->op]
+#else
+  #define VM_CASE(name)   case name:
+  #define VM_DEFAULT      default:
+  #define VM_DISPATCH()   continue
+#endif
+// plain braces, not do/while(0): in the switch build VM_DISPATCH is a
+// 'continue' that must reach the outer loop
+#define VM_NEXT()         { ++pc; VM_DISPATCH(); }
+#define VM_JUMP(target)   { pc = code + (target); VM_DISPATCH(); }
+
+#if MONDOT_THREADED && defined(__GNUC__)
+  #pragma GCC diagnostic push
+  #pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+// Runs frames until the one at entry_depth returns. Calls and returns
+// between bytecode functions stay inside this loop: a call pushes a Frame
+// and switches the cached registers over to it, a return pops it and
+// resumes the caller at ret_pc. The C++ stack never grows with script
+// recursion.
+//
+// The cached sp is written back to top before anything that can throw or
+// that touches the stack itself (push_frame, host calls).
+Value VM::run(size_t entry_depth)
+{
+    ByteFunc *f;
+    const Op *code;
+    const Op *pc;
+    const Value *consts;
+    Value *locals;
+    Value *base;    // bottom of the operand stack, for RET
+    Value *sp = top;
+    Value ret;      // result of the returning frame
+
+#define VM_LOAD_FRAME()                                 \
+    {                                                   \
+        const Frame &fr = frames.back();                \
+        f = fr.func;                                    \
+        code = f->code.data();                          \
+        consts = f->const_data;                         \
+        locals = stack.data() + fr.base;                \
+        base = locals + f->locals.size();               \
+    }
+#define VM_DROP()   { --sp; *sp = Value(); }
+// Quickening: a generic handler that sees number operands rewrites its own
+// instruction into the _NN form (unless the instruction has already been
+// de-quickened QUICKEN_LIMIT times); a quickened handler whose guard fails
+// turns it back and re-dispatches to the generic handler. Neither changes
+// the stack depth at that ip.
+#define VM_QUICKEN(qop)   quicken(*f, pc, (qop))
+#define VM_DEQUICKEN()    { dequicken(*f, pc); VM_DISPATCH(); }
+// Hands the current frame over to f's jitted code from ip on, once
+// jit_ready agrees; the code runs to the frame's return and RET's tail
+// takes it from there.
+#if MONDOT_JIT_ENABLED
+  #define VM_TRY_JIT(ip, threshold)                                                     \
+    if(jit_mode != JitMode::Off && !f->jit_unsupported && jit_ready(*f, (threshold)))   \
+    {                                                                                   \
+        top = sp;                                                                       \
+        ret = enter_jit(*f, locals, (uint32_t)(ip));                                    \
+        sp = top;                                                                       \
+        goto vm_return;                                                                 \
+    }
+#else
+  #define VM_TRY_JIT(ip, threshold)
+#endif
+
+    VM_LOAD_FRAME();
+    pc = code;
+    VM_TRY_JIT(0, JIT_CALL_THRESHOLD);
+
+#if MONDOT_THREADED
+    static void *const dispatch_table[OP_COUNT] = {
+#define MONDOT_OPCODE_LABEL(name) &&L_OP_##name,
+        MONDOT_OPCODE_LIST(MONDOT_OPCODE_LABEL)
+#undef MONDOT_OPCODE_LABEL
+    };
+    VM_DISPATCH();
+#else
+    for(;;)
+    switch(pc->op)
+#endif
     {
-        Op &op = f.code[ip];
+        VM_CASE(OP_NOP)
+            VM_NEXT();
 
-        switch(op.op)
-        {
-            case OP_PUSH_CONST:
-                eval_stack.push_back(
-                    valid_const(f, op.a) ? f.consts[op.a] : Value::make_nil()
-                );
-                break;
+        VM_CASE(OP_PUSH_CONST)
+            *sp++ = consts[pc->a];
+            VM_NEXT();
 
-            case OP_PUSH_LOCAL:
-                eval_stack.push_back(
-                    valid_local(fr, op.a) ? fr.locals[op.a] : Value::make_nil()
-                );
-                break;
+        VM_CASE(OP_PUSH_LOCAL)
+            *sp++ = locals[pc->a];
+            VM_NEXT();
 
-            case OP_STORE_LOCAL:
+        VM_CASE(OP_PUSH_LOCAL_MOVE)
+            *sp++ = move(locals[pc->a]);
+            VM_NEXT();
+
+        VM_CASE(OP_STORE_LOCAL)
+            --sp;
+            locals[pc->a] = move(*sp);
+            VM_NEXT();
+
+        VM_CASE(OP_ADD)
+        {
+            Value &a = sp[-2];
+            const Value &b = sp[-1];
+            if(a.is_number() && b.is_number())
             {
-                if(eval_stack.size() <= base_sp) break;
-                Value v = eval_stack.back(); eval_stack.pop_back();
-                if(valid_local(fr, op.a)) fr.locals[op.a] = v;
-                break;
+                a = Value::make_number(a.num() + b.num());
+                VM_QUICKEN(OP_ADD_NN);
             }
+            else a = arith_slow(OP_ADD, a, b);
+            VM_DROP();
+            VM_NEXT();
+        }
 
-            case OP_POP:
+        VM_CASE(OP_SUB)
+        {
+            Value &a = sp[-2];
+            const Value &b = sp[-1];
+            if(a.is_number() && b.is_number())
             {
-                size_t n = (size_t)max(0, op.a);
-                size_t sp = eval_stack.size();
-                eval_stack.resize(sp > n ? max(base_sp, sp - n) : base_sp);
-                break;
+                a = Value::make_number(a.num() - b.num());
+                VM_QUICKEN(OP_SUB_NN);
             }
+            else a = arith_slow(OP_SUB, a, b);
+            VM_DROP();
+            VM_NEXT();
+        }
 
-            case OP_CALL:
+        VM_CASE(OP_MUL)
+        {
+            Value &a = sp[-2];
+            const Value &b = sp[-1];
+            if(a.is_number() && b.is_number())
             {
-                int nargs = op.a;
-                bool dynamic = (op.b == -2);
-
-                if(eval_stack.size() < base_sp + nargs + (dynamic?1:0))
-                    break;
+                a = Value::make_number(a.num() * b.num());
+                VM_QUICKEN(OP_MUL_NN);
+            }
+            else a = arith_slow(OP_MUL, a, b);
+            VM_DROP();
+            VM_NEXT();
+        }
 
-                arg_scratch.clear();
+        VM_CASE(OP_DIV)
+        VM_CASE(OP_MOD)
+        {
+            Value &a = sp[-2];
+            bool nn = a.is_number() && sp[-1].is_number();
+            a = arith_slow(pc->op, a, sp[-1]);
+            if(nn) VM_QUICKEN(pc->op == OP_DIV ? OP_DIV_NN : OP_MOD_NN);
+            VM_DROP();
+            VM_NEXT();
+        }
 
-                if(dynamic)
-                {
-                    Value callee = eval_stack.back();
-                    eval_stack.pop_back();
-
-                    size_t sp = eval_stack.size();
-                    arg_scratch.insert(
-                        arg_scratch.end(),
-                        eval_stack.begin() + (sp - nargs),
-                        eval_stack.begin() + sp
-                    );
-                    eval_stack.resize(sp - nargs);
-
-                    if(callee.tag == Tag::Number)
-                        eval_stack.push_back(
-                            call_bytecode_function(fr.module, (int)callee.num, arg_scratch)
-                        );
-                    else
-                        eval_stack.push_back(Value::make_nil());
-                }
-                else if(op.b >= 0)
-                {
-                    size_t sp = eval_stack.size();
-                    arg_scratch.insert(
-                        arg_scratch.end(),
-                        eval_stack.begin() + (sp - nargs),
-                        eval_stack.begin() + sp
-                    );
-                    eval_stack.resize(sp - nargs);
-
-                    eval_stack.push_back(
-                        call_bytecode_function(fr.module, op.b, arg_scratch)
-                    );
-                }
-                else if(op.b == -1)
+        VM_CASE(OP_LT)
+        VM_CASE(OP_LE)
+        VM_CASE(OP_GT)
+        VM_CASE(OP_GE)
+        {
+            Value &a = sp[-2];
+            const Value &b = sp[-1];
+            bool r = false;
+            if(a.is_number() && b.is_number())
+            {
+                switch(pc->op)
                 {
-                    size_t sp = eval_stack.size();
-                    arg_scratch.insert(
-                        arg_scratch.end(),
-                        eval_stack.begin() + (sp - nargs),
-                        eval_stack.begin() + sp
-                    );
-                    eval_stack.resize(sp - nargs);
-
-                    auto r = host.call_function(op.s, arg_scratch);
-                    eval_stack.push_back(r ? *r : Value::make_nil());
+                    case OP_LT: r = a.num() <  b.num(); break;
+                    case OP_LE: r = a.num() <= b.num(); break;
+                    case OP_GT: r = a.num() >  b.num(); break;
+                    default:    r = a.num() >= b.num(); break;
                 }
-                break;
+                VM_QUICKEN(quickened_compare(pc));
+            }
+            a = Value::make_boolean(r);
+            VM_DROP();
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_EQ)
+        VM_CASE(OP_NE)
+        {
+            Value &a = sp[-2];
+            bool nn = a.is_number() && sp[-1].is_number();
+            bool r = values_equal(a, sp[-1]);
+            a = Value::make_boolean(pc->op == OP_EQ ? r : !r);
+            if(nn) VM_QUICKEN(quickened_compare(pc));
+            VM_DROP();
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_NOT)
+        {
+            Value &a = sp[-1];
+            a = Value::make_boolean(!is_truthy(a));
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_NEG)
+        {
+            Value &a = sp[-1];
+            if(a.is_number()) a = Value::make_number(-a.num());
+            else a = Value::make_number(0.0);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_POP)
+        {
+            for(int n = pc->a; n > 0; --n) VM_DROP();
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_CALL)
+        VM_CASE(OP_CALL_DYNAMIC)
+        {
+            int nargs = pc->a;
+            int callee_idx = pc->b;
+            if(pc->op == OP_CALL_DYNAMIC)
+            {
+                --sp;
+                Value callee = move(*sp);
+                callee_idx = callee.is_number() ? (int)callee.num() : -1;
             }
 
-            case OP_JMP:
-                ip = (size_t)op.a - 1;
-                break;
+            Module *m = frames.back().module;
+            if(callee_idx < 0 || callee_idx >= (int)m->bytecode.funcs.size())
+            {
+                for(int n = 0; n < nargs; ++n) VM_DROP();
+                ++sp;   // nil result
+                VM_NEXT();
+            }
 
-            case OP_JMP_IF_FALSE:
+            top = sp;
+            ByteFunc &callee = m->bytecode.funcs[callee_idx];
+            ensure_compiled(m->bytecode, callee, host);
+            push_frame(m, callee, nargs, pc + 1);
+            sp = top;
+            VM_LOAD_FRAME();
+            pc = code;
+            VM_TRY_JIT(0, JIT_CALL_THRESHOLD);
+            VM_DISPATCH();
+        }
+
+        VM_CASE(OP_CALL_HOST)
+        VM_CASE(OP_CALL_HOST_NUM)
+        VM_CASE(OP_CALL_HOST_POP)
+        {
+            int nargs = pc->a;
+            // the host reads the args where they are; they are dropped after
+            top = sp;
+            HostSlot *slot = host.site_slot(f->host_calls[pc->b]);
+            ArgSpan args{sp - nargs, (size_t)nargs};
+            Value r;
+            if(!slot) r = Value::make_nil();
+            else if(pc->op == OP_CALL_HOST_NUM && slot->unboxed && slot->sig.argc == nargs &&
+                    (!pc->c || all_numbers(args)))
+                r = Value::make_number(slot->unboxed(args.data));
+            else r = slot->call(args);
+            for(int n = 0; n < nargs; ++n) VM_DROP();
+            if(pc->op != OP_CALL_HOST_POP) *sp++ = move(r);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_JMP)
+#if MONDOT_JIT_ENABLED
+            if(pc->a <= pc - code)
             {
-                if(eval_stack.size() <= base_sp) break;
-                Value cond = eval_stack.back(); eval_stack.pop_back();
-                if(!is_truthy(cond)) ip = (size_t)op.a - 1;
-                break;
+                VM_TRY_JIT(pc->a, JIT_BACKEDGE_THRESHOLD);
             }
+#endif
+            VM_JUMP(pc->a);
 
-            case OP_RET:
+        VM_CASE(OP_JMP_IF_FALSE)
+        {
+            bool truthy = is_truthy(sp[-1]);
+            VM_DROP();
+            if(!truthy) VM_JUMP(pc->a);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_JMP_IF_TRUE)
+        {
+            bool truthy = is_truthy(sp[-1]);
+            VM_DROP();
+            if(truthy) VM_JUMP(pc->a);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_ITER_PREP)
+            --sp;
+            locals[pc->a] = move(*sp);
+            locals[pc->a + 1] = Value::make_number(0.0);
+            VM_NEXT();
+
+        VM_CASE(OP_ITER_NEXT)
+        {
+            const Value &seq = locals[pc->b];
+            Value &idx = locals[pc->b + 1];
+            size_t i = (size_t)idx.num();
+            if(!seq.is_string() || i >= seq.str().size()) VM_JUMP(pc->a);
+            *sp++ = char_string((unsigned char)seq.str()[i]);
+            idx = Value::make_number((double)(i + 1));
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_FORPREP)
+        {
+            // start, limit, step on top
+            Value *h = locals + pc->b;
+            bool run = for_enters(sp[-3], sp[-2], sp[-1]);
+            if(run)
             {
-                Value ret = Value::make_nil();
-                if(eval_stack.size() > base_sp)
-                    ret = eval_stack.back();
+                h[0] = sp[-3];
+                h[1] = sp[-2];
+                h[2] = sp[-1];
+                h[3] = sp[-3];
+            }
+            VM_DROP();
+            VM_DROP();
+            VM_DROP();
+            if(run) VM_NEXT();
+            VM_JUMP(pc->a);
+        }
 
-                eval_stack.resize(base_sp);
+        VM_CASE(OP_FORLOOP)
+        {
+            Value *h = locals + pc->b;
+            double step = h[2].num();
+            double i = h[0].num() + step;
+            if(!for_continues(i, h[1].num(), step)) VM_NEXT();
+            h[0] = Value::make_number(i);
+            h[3] = Value::make_number(i);
+            VM_JUMP(pc->a);
+        }
+
+        VM_CASE(OP_RET)
+        VM_CASE(OP_RET_CONST)
+        {
+            if(pc->op == OP_RET_CONST) ret = consts[pc->a];
+            else if(sp > base) ret = move(sp[-1]);
+#if MONDOT_JIT_ENABLED
+        vm_return:
+#endif
+
+            // clear the callee's window; the caller's operand stack resumes
+            // where the args were
+            while(sp > locals) VM_DROP();
+            const Op *ret_pc = frames.back().ret_pc;
+            frames.pop_back();
+            if(frames.size() == entry_depth)
+            {
+                top = sp;
                 return ret;
             }
 
-            default:
-                dbg("VM: unknown opcode");
-                break;
+            VM_LOAD_FRAME();
+            *sp++ = move(ret);
+            pc = ret_pc;
+            VM_DISPATCH();
+        }
+
+        // superinstructions
+
+        VM_CASE(OP_PUSH_LOCAL2)
+            sp[0] = locals[pc->a];
+            sp[1] = locals[pc->b];
+            sp += 2;
+            VM_NEXT();
+
+        VM_CASE(OP_STORE_CONST)
+            locals[pc->a] = consts[pc->b];
+            VM_NEXT();
+
+        VM_CASE(OP_MOVE_LOCAL)
+            locals[pc->a] = locals[pc->b];
+            VM_NEXT();
+
+        VM_CASE(OP_INC_LOCAL)
+        {
+            Value &x = locals[pc->a];
+            const Value &k = consts[pc->b];
+            if(x.is_number() && k.is_number()) x = Value::make_number(x.num() + k.num());
+            else x = arith_slow(OP_ADD, x, k);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_TEST_LT_LK)
+        VM_CASE(OP_TEST_LE_LK)
+        VM_CASE(OP_TEST_GT_LK)
+        VM_CASE(OP_TEST_GE_LK)
+        VM_CASE(OP_TEST_EQ_LK)
+        VM_CASE(OP_TEST_NE_LK)
+        {
+            const Value &x = locals[pc->b];
+            const Value &k = consts[pc->c];
+            bool r = test_local_const(pc->op, x, k);
+            if(x.is_number() && k.is_number())
+                VM_QUICKEN((OpCode)(OP_TEST_LT_LN + (pc->op - OP_TEST_LT_LK)));
+            if(!r) VM_JUMP(pc->a);
+            VM_NEXT();
+        }
+
+        // quickened forms, see VM_QUICKEN
+
+#define VM_ARITH_NN(name, expr)                                     \
+        VM_CASE(name)                                               \
+        {                                                           \
+            Value &a = sp[-2];                                      \
+            const Value &b = sp[-1];                                \
+            if(!a.is_number() || !b.is_number()) VM_DEQUICKEN();    \
+            double x = a.num(), y = b.num();                        \
+            a = Value::make_number(expr);                           \
+            VM_DROP();                                              \
+            VM_NEXT();                                              \
+        }
+#define VM_COMPARE_NN(name, cmp)                                    \
+        VM_CASE(name)                                               \
+        {                                                           \
+            Value &a = sp[-2];                                      \
+            const Value &b = sp[-1];                                \
+            if(!a.is_number() || !b.is_number()) VM_DEQUICKEN();    \
+            a = Value::make_boolean(a.num() cmp b.num());           \
+            VM_DROP();                                              \
+            VM_NEXT();                                              \
+        }
+#define VM_BRANCH_NN(name, cmp)                                     \
+        VM_CASE(name)                                               \
+        {                                                           \
+            const Value &a = sp[-2];                                \
+            const Value &b = sp[-1];                                \
+            if(!a.is_number() || !b.is_number()) VM_DEQUICKEN();    \
+            bool r = a.num() cmp b.num();                           \
+            VM_DROP();                                              \
+            VM_DROP();                                              \
+            if(!r) VM_JUMP(pc[1].a);                                \
+            pc += 2;                                                \
+            VM_DISPATCH();                                          \
+        }
+#define VM_TEST_LN(name, cmp)                                       \
+        VM_CASE(name)                                               \
+        {                                                           \
+            const Value &x = locals[pc->b];                         \
+            if(!x.is_number()) VM_DEQUICKEN();                      \
+            if(!(x.num() cmp consts[pc->c].num())) VM_JUMP(pc->a);  \
+            VM_NEXT();                                              \
+        }
+
+        VM_ARITH_NN(OP_ADD_NN, x + y)
+        VM_ARITH_NN(OP_SUB_NN, x - y)
+        VM_ARITH_NN(OP_MUL_NN, x * y)
+        VM_ARITH_NN(OP_DIV_NN, y != 0.0 ? x / y : 0.0)
+        VM_ARITH_NN(OP_MOD_NN, y != 0.0 ? fmod(x, y) : 0.0)
+
+        VM_COMPARE_NN(OP_LT_NN, <)
+        VM_COMPARE_NN(OP_LE_NN, <=)
+        VM_COMPARE_NN(OP_GT_NN, >)
+        VM_COMPARE_NN(OP_GE_NN, >=)
+        VM_COMPARE_NN(OP_EQ_NN, ==)
+        VM_COMPARE_NN(OP_NE_NN, !=)
+
+        VM_BRANCH_NN(OP_JLT_NN, <)
+        VM_BRANCH_NN(OP_JLE_NN, <=)
+        VM_BRANCH_NN(OP_JGT_NN, >)
+        VM_BRANCH_NN(OP_JGE_NN, >=)
+        VM_BRANCH_NN(OP_JEQ_NN, ==)
+        VM_BRANCH_NN(OP_JNE_NN, !=)
+
+        VM_TEST_LN(OP_TEST_LT_LN, <)
+        VM_TEST_LN(OP_TEST_LE_LN, <=)
+        VM_TEST_LN(OP_TEST_GT_LN, >)
+        VM_TEST_LN(OP_TEST_GE_LN, >=)
+        VM_TEST_LN(OP_TEST_EQ_LN, ==)
+        VM_TEST_LN(OP_TEST_NE_LN, !=)
+
+#undef VM_ARITH_NN
+#undef VM_COMPARE_NN
+#undef VM_BRANCH_NN
+#undef VM_TEST_LN
+
+        VM_DEFAULT
+        {
+            dbg("VM: unknown opcode");
+            VM_NEXT();
         }
     }
 
-    eval_stack.resize(base_sp);
-    return Value::make_nil();
+#undef VM_LOAD_FRAME
+#undef VM_DROP
+#undef VM_QUICKEN
+#undef VM_DEQUICKEN
+#undef VM_TRY_JIT
 }
+
+#if MONDOT_THREADED && defined(__GNUC__)
+  #pragma GCC diagnostic pop
+#endif
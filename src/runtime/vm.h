@@ -3,29 +3,54 @@
 
 #include "host.h"
 #include "bytecode.h"
+#include "jit.h"
 #include <string>
 #include <vector>
 #include "module.h"
 
+// One activation. Its locals are a window of VM::stack starting at base
+// (params first, so a caller's args become the callee's params in place),
+// and its operand stack follows right after the locals.
 struct Frame
 {
     Module *module = nullptr;
     ByteFunc *func = nullptr;
-    std::vector<Value> locals;
-    size_t ip = 0;
+    const Op *ret_pc = nullptr;   // where the caller resumes
+    size_t base = 0;
 };
 
 struct VM
 {
+    static constexpr size_t INITIAL_STACK_SLOTS = 4096;
+    static constexpr size_t DEFAULT_MAX_CALL_DEPTH = 10000;
+
     HostBridge &host;
     VM(HostBridge &h);
     Value execute_handler(Module* m, const std::string &handler_name);
     Value execute_handler_idx(Module* m, int idx);
-    Value run_frame(Frame &fr);
+
+    // deeper script recursion raises runtime_error
+    void set_max_call_depth(size_t depth);
+    size_t get_max_call_depth() const { return max_call_depth; }
+
+    // baseline JIT, see jit.h; Hot by default in MONDOT_JIT builds
+    void set_jit_mode(JitMode mode) { jit_mode = mode; }
+    JitMode get_jit_mode() const { return jit_mode; }
+
 private:
-    std::vector<Value> eval_stack;
-    std::vector<Value> arg_scratch;
-    Value call_bytecode_function(Module* m, int func_idx, const std::vector<Value> &args);
+    // every slot at or above top is nil
+    std::vector<Value> stack;
+    Value *top = nullptr;
+    std::vector<Frame> frames;
+    size_t max_call_depth = DEFAULT_MAX_CALL_DEPTH;
+    JitMode jit_mode = MONDOT_JIT_ENABLED ? JitMode::Hot : JitMode::Off;
+
+    void reserve_stack(size_t slots);
+    void push_frame(Module *m, ByteFunc &f, int nargs, const Op *ret_pc);
+    void unwind(size_t depth, size_t entry_used);
+    Value run(size_t entry_depth);
+    bool jit_ready(ByteFunc &f, uint32_t threshold);
+    Value enter_jit(ByteFunc &f, Value *locals, uint32_t ip);
 };
 
 #endif
@@ -0,0 +1,118 @@
+#ifndef MONDOT_VM_OPS_H
+#define MONDOT_VM_OPS_H
+
+#include "value.h"
+#include "bytecode.h"
+#include <cmath>
+
+// Semantics of the generic opcodes that both execution engines share: the
+// interpreter's handlers and the JIT's out-of-line helpers call these, so
+// jitted and interpreted code cannot drift apart.
+
+// ADD on anything but two numbers: the concatenation of both string
+// forms. When a is the only reference to a non-interned string, e.g. a
+// local moved onto the stack by its last use (PUSH_LOCAL_MOVE), its buffer
+// is appended to instead of copied. Every caller assigns the result back
+// to a, so nothing sees the emptied object.
+inline Value concat_slow(Value &a, const Value &b)
+{
+    std::string s;
+    StringObject *o = a.is_string() ? a.string_object() : nullptr;
+    if(o && !o->interned && o->refs.load(std::memory_order_acquire) == 1) s = std::move(o->str);
+    else if(o) s = o->str;
+    else s = value_to_string(a);
+    if(b.is_string()) s += b.str();
+    else s += value_to_string(b);
+    return Value::make_string(std::move(s));
+}
+
+// slow paths for the arithmetic / comparison opcodes; they mirror the
+// semantics of the equivalent host builtins (add, sub, lt, eq, ...). The
+// result always replaces a (see concat_slow).
+inline Value arith_slow(OpCode op, Value &a, const Value &b)
+{
+    if(op == OP_ADD && (!a.is_number() || !b.is_number()))
+        return concat_slow(a, b);
+    if(!a.is_number() || !b.is_number())
+        return Value::make_number(0.0);
+
+    switch(op)
+    {
+        case OP_ADD: return Value::make_number(a.num() + b.num());
+        case OP_SUB: return Value::make_number(a.num() - b.num());
+        case OP_MUL: return Value::make_number(a.num() * b.num());
+        case OP_DIV: return Value::make_number(b.num() != 0.0 ? a.num() / b.num() : 0.0);
+        case OP_MOD: return Value::make_number(b.num() != 0.0 ? std::fmod(a.num(), b.num()) : 0.0);
+        default: return Value::make_number(0.0);
+    }
+}
+
+// ADD..NE, NOT or NEG (which ignore b) on operands known at compile
+// time, with the results the handlers compute; lets the compiler fold
+// constants without drifting from the VM
+inline Value fold_op(OpCode op, const Value &a, const Value &b)
+{
+    switch(op)
+    {
+        case OP_NOT: return Value::make_boolean(!is_truthy(a));
+        case OP_NEG: return Value::make_number(a.is_number() ? -a.num() : 0.0);
+        case OP_EQ: return Value::make_boolean(values_equal(a, b));
+        case OP_NE: return Value::make_boolean(!values_equal(a, b));
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+        {
+            if(!a.is_number() || !b.is_number()) return Value::make_boolean(false);
+            double x = a.num(), y = b.num();
+            bool r = op == OP_LT ? x < y : op == OP_LE ? x <= y : op == OP_GT ? x > y : x >= y;
+            return Value::make_boolean(r);
+        }
+        default:
+        {
+            Value x = a;
+            return arith_slow(op, x, b);
+        }
+    }
+}
+
+// CALL_HOST_NUM with c set: some argument is only a number as long as
+// the host function that produced it has not been re-registered
+inline bool all_numbers(ArgSpan args)
+{
+    for(const Value &v : args)
+        if(!v.is_number()) return false;
+    return true;
+}
+
+// fast path of the fused TEST_*_LK ops; same results as the LT..NE
+// handlers followed by JMP_IF_FALSE
+inline bool test_local_const(OpCode op, const Value &a, const Value &b)
+{
+    switch(op)
+    {
+        case OP_TEST_EQ_LK: return values_equal(a, b);
+        case OP_TEST_NE_LK: return !values_equal(a, b);
+        default: break;
+    }
+    if(!a.is_number() || !b.is_number()) return false;
+    switch(op)
+    {
+        case OP_TEST_LT_LK: return a.num() <  b.num();
+        case OP_TEST_LE_LK: return a.num() <= b.num();
+        case OP_TEST_GT_LK: return a.num() >  b.num();
+        default:            return a.num() >= b.num();
+    }
+}
+
+// numeric for: whether counter i is still within limit, and whether the
+// loop runs at all (FORPREP); a zero step never runs, it would not end
+inline bool for_continues(double i, double limit, double step)
+{
+    return step > 0 ? i <= limit : i >= limit;
+}
+
+inline bool for_enters(const Value &start, const Value &limit, const Value &step)
+{
+    return start.is_number() && limit.is_number() && step.is_number() && step.num() != 0.0 &&
+           for_continues(start.num(), limit.num(), step.num());
+}
+
+#endif
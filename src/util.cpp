@@ -89,6 +89,16 @@ static void collect_tokens_from_expr(const Expr* e, std::set<std::string> &out)
             else add_tok_str(out, "Call");
             for (const auto &a : e->args) collect_tokens_from_expr(a.get(), out);
             break;
+        case Expr::KUnary:
+        case Expr::KBinary:
+        case Expr::KLogical:
+            add_tok_str(out, std::string("op:") + e->op);
+            for (const auto &a : e->args) collect_tokens_from_expr(a.get(), out);
+            break;
+        case Expr::KConditional:
+            add_tok_str(out, "op:?:");
+            for (const auto &a : e->args) collect_tokens_from_expr(a.get(), out);
+            break;
         case Expr::KFuncLiteral:
             add_tok_str(out, "func-literal");
             for (const auto &p : e->params) add_tok_str(out, std::string("param:") + p);
@@ -149,6 +159,14 @@ static void collect_tokens_from_stmt(const Stmt* s, std::set<std::string> &out)
             collect_tokens_from_expr(s->iter_expr.get(), out);
             for (const auto &b : s->foreach_body) collect_tokens_from_stmt(b.get(), out);
             break;
+        case Stmt::KFor:
+            add_tok_str(out, "for");
+            add_tok_str(out, std::string("it:") + s->iter_name);
+            collect_tokens_from_expr(s->range_start.get(), out);
+            collect_tokens_from_expr(s->range_limit.get(), out);
+            if (s->range_step) collect_tokens_from_expr(s->range_step.get(), out);
+            for (const auto &b : s->foreach_body) collect_tokens_from_stmt(b.get(), out);
+            break;
         case Stmt::KReturn:
             add_tok_str(out, "return");
             collect_tokens_from_expr(s->expr.get(), out);
@@ -219,6 +237,28 @@ void dump_module_bytecode(const Module* m, FILE* out)
         fprintf(out, "%s%s%s %s%s%s\n", COL_DARKGRAY, header.c_str(), COL_RESET, COL_GREEN, handlers_joined.c_str(), COL_RESET);
     else
         fprintf(out, "%s %s\n", header.c_str(), handlers_joined.c_str());
+
+    fprintf(out, "  %zu shared consts\n", bm.consts ? bm.consts->size() : (size_t)0);
+    for (const auto &kv : bm.handler_index)
+    {
+        if (kv.second < 0 || (size_t)kv.second >= bm.funcs.size()) continue;
+        const ByteFunc &f = bm.funcs[kv.second];
+        if (f.lazy && !f.lazy->compiled.load())
+        {
+            fprintf(out, "  %s: compiled on its first call\n", kv.first.c_str());
+            continue;
+        }
+        fprintf(out, "  %s: %zu ops, max locals %zu (%u params), max stack %u\n",
+                kv.first.c_str(), f.code.size(), f.locals.size(), f.nparams, f.max_stack);
+        for (size_t ip = 0; ip < f.code.size(); ++ip)
+        {
+            std::string line = disassemble_op(f, ip);
+            if (TERM_SUPPORTS_COLOR)
+                fprintf(out, "    %s%4zu%s  %s\n", COL_DARKGRAY, ip, COL_RESET, line.c_str());
+            else
+                fprintf(out, "    %4zu  %s\n", ip, line.c_str());
+        }
+    }
 }
 
 #endif
@@ -46,6 +46,7 @@ constexpr inline const char* token_kind_to_string(TokenKind k)
         case TokenKind::Kw_elseif: return "Kw_elseif";
         case TokenKind::Kw_while: return "Kw_while";
         case TokenKind::Kw_foreach: return "Kw_foreach";
+        case TokenKind::Kw_for: return "Kw_for";
         case TokenKind::Kw_in: return "Kw_in";
         case TokenKind::Kw_return: return "Kw_return";
         case TokenKind::Kw_local: return "Kw_local";
@@ -58,6 +59,8 @@ constexpr inline const char* token_kind_to_string(TokenKind k)
         case TokenKind::RBracket: return "RBracket";
         case TokenKind::Comma: return "Comma";
         case TokenKind::Semicolon: return "Semicolon";
+        case TokenKind::Question: return "Question";
+        case TokenKind::Colon: return "Colon";
 
         case TokenKind::Plus: return "Plus";
         case TokenKind::Minus: return "Minus";
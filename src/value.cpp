@@ -1,55 +1,57 @@
 #include "value.h"
-#include <sstream>
+#include "intern.h"
+#include <cstdio>
 
 using namespace std;
 
-Value Value::make_nil()
+Value Value::make_string(const string &str)
 {
-    return Value();
+    size_t h = hash_string(str);
+    if(str.size() <= MAX_AUTO_INTERN_LENGTH) return intern_table().intern(str, h);
+    return adopt_string(new StringObject(str, h, false));
 }
-Value Value::make_boolean(bool b)
+Value Value::make_string(string &&str)
 {
-    Value v;
-    v.tag = Tag::Boolean;
-    v.boolean = b;
-    return v;
+    size_t h = hash_string(str);
+    if(str.size() <= MAX_AUTO_INTERN_LENGTH) return intern_table().intern(str, h);
+    return adopt_string(new StringObject(move(str), h, false));
 }
-Value Value::make_number(double n)
+Value Value::make_interned(const string &str)
 {
-    Value v;
-    v.tag = Tag::Number;
-    v.num = n;
-    return v;
+    return intern_table().intern(str, hash_string(str));
 }
-Value Value::make_string(const string &str)
+
+void Value::destroy_string(StringObject *o)
 {
-    Value v;
-    v.tag = Tag::String;
-    v.s = make_shared<string>(str);
-    return v;
+    if(o->interned) intern_table().forget(o);
+    delete o;
 }
-Value Value::make_rule(const Rule &rule)
+
+const Value &char_string(unsigned char c)
 {
-    Value v;
-    v.tag = Tag::Rule;
-    v.r = make_shared<Rule>(rule);
-    return v;
+    static const Value *table = []
+    {
+        Value *t = new Value[256];
+        for(int i = 0; i < 256; ++i) t[i] = Value::make_interned(string(1, (char)i));
+        return t;
+    }();
+    return table[c];
 }
 
 string value_to_string(const Value &v)
 {
-    switch(v.tag)
+    switch(v.tag())
     {
         case Tag::Nil: return "nil";
-        case Tag::Boolean: return v.boolean? "true": "false";
+        case Tag::Boolean: return v.boolean()? "true": "false";
         case Tag::Number:
         {
-            ostringstream oss;
-            oss << v.num;
-            return oss.str();
+            char buf[32];
+            int n = snprintf(buf, sizeof(buf), "%.15g", v.num());
+            return n > 0 ? string(buf, (size_t)n) : string("<badnum>");
         }
-        case Tag::String: return v.s ? *v.s : string("(null)");
-        case Tag::Rule: return string("Rule(") + (v.r ? to_string(v.r->id) : string("0")) + ")";
+        case Tag::String: return v.str();
+        case Tag::Rule: return string("Rule(") + to_string(v.rule().id) + ")";
     }
     return string("?");
 }
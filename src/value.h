@@ -1,9 +1,10 @@
 #ifndef MONDOT_VALUE_H
 #define MONDOT_VALUE_H
 
-#include <memory>
+#include <atomic>
 #include <string>
 #include <cstdint>
+#include <cstring>
 
 struct Rule
 {
@@ -16,22 +17,184 @@ enum class Tag
     Nil, Boolean, Number, String, Rule
 };
 
+// refcounted heap payload of a string Value. The hash is computed once at
+// creation; interned objects are unique per content, so two interned
+// strings are equal exactly when their pointers are.
+struct StringObject
+{
+    std::atomic<uint32_t> refs{1};
+    bool interned = false;
+    size_t hash = 0;
+    std::string str;
+
+    StringObject(std::string s, size_t h, bool in): interned(in), hash(h), str(std::move(s)) {}
+};
+
+inline bool string_objects_equal(const StringObject *a, const StringObject *b)
+{
+    if(a == b) return true;
+    if(a->interned && b->interned) return false;
+    return a->hash == b->hash && a->str == b->str;
+}
+
+// NaN-boxed 8-byte value.
+//
+// Any double that is not a quiet NaN with the 0x7ffc prefix is stored as is
+// (NaNs are canonicalized on the way in). The remaining bit patterns encode
+// the other types in their top 16 bits:
+//   0x7ffc  nil / false / true      (payload 0 / 2 / 3)
+//   0x7ffd  rule                    (payload type << 32 | id)
+//   0xfffc  string                  (payload StringObject*)
+// Only strings own heap memory, so copying any other value is a plain
+// 8-byte copy plus one predictable branch.
 struct Value
 {
-    Tag tag = Tag::Nil;
-    bool boolean = false;
-    double num = 0.0;
-    std::shared_ptr<std::string> s;
-    std::shared_ptr<Rule> r;
+    static constexpr uint64_t QNAN        = 0x7ffc000000000000ull;
+    static constexpr uint64_t CANON_NAN   = 0x7ff8000000000000ull;
+    static constexpr uint64_t TOP_MISC    = 0x7ffc;
+    static constexpr uint64_t TOP_RULE    = 0x7ffd;
+    static constexpr uint64_t TOP_STRING  = 0xfffc;
+    static constexpr uint64_t PAYLOAD     = 0x0000ffffffffffffull;
+    static constexpr uint64_t NIL_BITS    = QNAN | 0;
+    static constexpr uint64_t FALSE_BITS  = QNAN | 2;
+    static constexpr uint64_t TRUE_BITS   = QNAN | 3;
+
+    Value(): bits(NIL_BITS) {}
+    Value(const Value &o): bits(o.bits) { retain(); }
+    Value(Value &&o) noexcept: bits(o.bits) { o.bits = NIL_BITS; }
+    ~Value() { release(); }
+
+    Value &operator=(const Value &o)
+    {
+        if(this != &o)
+        {
+            o.retain();
+            release();
+            bits = o.bits;
+        }
+        return *this;
+    }
+    Value &operator=(Value &&o) noexcept
+    {
+        if(this != &o)
+        {
+            release();
+            bits = o.bits;
+            o.bits = NIL_BITS;
+        }
+        return *this;
+    }
 
-    Value() = default;
     static Value make_nil();
     static Value make_boolean(bool n);
     static Value make_number(double n);
     static Value make_string(const std::string &str);
+    static Value make_string(std::string &&str);
+    // always goes through the intern table, whatever the length
+    static Value make_interned(const std::string &str);
     static Value make_rule(const Rule &rule);
+    // wraps o, taking over one of its references
+    static Value adopt_string(StringObject *o);
+
+    bool is_number() const { return (bits & QNAN) != QNAN; }
+    bool is_string() const { return (bits >> 48) == TOP_STRING; }
+    bool is_nil() const { return bits == NIL_BITS; }
+    bool is_boolean() const { return bits == FALSE_BITS || bits == TRUE_BITS; }
+
+    Tag tag() const
+    {
+        if(is_number()) return Tag::Number;
+        switch(bits >> 48)
+        {
+            case TOP_STRING: return Tag::String;
+            case TOP_RULE: return Tag::Rule;
+            default: return bits == NIL_BITS ? Tag::Nil : Tag::Boolean;
+        }
+    }
+
+    double num() const
+    {
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+    bool boolean() const { return bits == TRUE_BITS; }
+    const std::string &str() const { return string_object()->str; }
+    Rule rule() const { return Rule{(uint16_t)((bits >> 32) & 0xffff), (uint32_t)bits}; }
+
+    StringObject *string_object() const { return reinterpret_cast<StringObject*>(bits & PAYLOAD); }
+    uint64_t raw_bits() const { return bits; }
+
+private:
+    uint64_t bits;
+
+    void retain() const
+    {
+        if(is_string()) string_object()->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release()
+    {
+        if(is_string() && string_object()->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            destroy_string(string_object());
+    }
+    static void destroy_string(StringObject *o);
 };
 
+static_assert(sizeof(Value) == 8, "Value must stay NaN-boxed in 8 bytes");
+static_assert(sizeof(void*) == 8, "NaN boxing requires 64-bit pointers");
+
+inline Value Value::make_nil()
+{
+    return Value();
+}
+inline Value Value::make_boolean(bool b)
+{
+    Value v;
+    v.bits = b ? TRUE_BITS : FALSE_BITS;
+    return v;
+}
+inline Value Value::make_number(double n)
+{
+    Value v;
+    if(n != n) v.bits = CANON_NAN;
+    else std::memcpy(&v.bits, &n, sizeof(n));
+    return v;
+}
+inline Value Value::adopt_string(StringObject *o)
+{
+    Value v;
+    v.bits = (TOP_STRING << 48) | reinterpret_cast<uint64_t>(o);
+    return v;
+}
+inline Value Value::make_rule(const Rule &rule)
+{
+    Value v;
+    v.bits = (TOP_RULE << 48) | ((uint64_t)rule.type << 32) | rule.id;
+    return v;
+}
+
+// strings up to this length are interned by make_string
+constexpr size_t MAX_AUTO_INTERN_LENGTH = 40;
+
+inline bool values_equal(const Value &a, const Value &b)
+{
+    if(a.is_number() || b.is_number())
+        return a.is_number() && b.is_number() && a.num() == b.num();
+    if(a.raw_bits() == b.raw_bits()) return true;
+    return a.is_string() && b.is_string() && string_objects_equal(a.string_object(), b.string_object());
+}
+
+// numbers are truthy when non-zero, everything else unless nil or false
+inline bool is_truthy(const Value &v)
+{
+    if(v.is_number()) return v.num() != 0.0;
+    return !v.is_nil() && v.raw_bits() != Value::FALSE_BITS;
+}
+
 std::string value_to_string(const Value &v);
 
+// the interned one-byte string for c, from a table of all 256 that is
+// built on first use and never freed
+const Value &char_string(unsigned char c);
+
 #endif